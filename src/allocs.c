@@ -0,0 +1,82 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+#include <stddef.h>
+#include <errno.h>
+#include "allocs.h"
+
+/* glibc's own allocator, which these wrap */
+extern void * __libc_malloc(size_t n);
+extern void * __libc_calloc(size_t n, size_t size);
+extern void * __libc_realloc(void * p, size_t n);
+extern void * __libc_memalign(size_t align, size_t n);
+extern void __libc_free(void * p);
+
+static int counting;
+static long count;
+
+static void counted(void) {
+	if (__atomic_load_n(&counting, __ATOMIC_RELAXED)) {
+		__atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+	}
+}
+
+void alloc_count_start(void) {
+	__atomic_store_n(&count, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&counting, 1, __ATOMIC_RELAXED);
+}
+
+/* Allocations (on any thread) since alloc_count_start */
+long alloc_count(void) {
+	return __atomic_load_n(&count, __ATOMIC_RELAXED);
+}
+
+void * malloc(size_t n) {
+	counted();
+	return __libc_malloc(n);
+}
+
+void * calloc(size_t n, size_t size) {
+	counted();
+	return __libc_calloc(n, size);
+}
+
+void * realloc(void * p, size_t n) {
+	counted();
+	return __libc_realloc(p, n);
+}
+
+void * memalign(size_t align, size_t n) {
+	counted();
+	return __libc_memalign(align, n);
+}
+
+void * aligned_alloc(size_t align, size_t n) {
+	return memalign(align, n);
+}
+
+int posix_memalign(void ** out, size_t align, size_t n) {
+	void * p;
+	if (align < sizeof(void*) || (align & (align - 1))) {
+		return EINVAL;
+	}
+	p = memalign(align, n);
+	if (!p) {
+		return ENOMEM;
+	}
+	*out = p;
+	return 0;
+}
+
+void free(void * p) {
+	__libc_free(p);
+}
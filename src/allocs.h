@@ -0,0 +1,20 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+/*
+ * Test hook for "nothing allocates once the session is built". Linking
+ * allocs.c replaces malloc and friends (glibc only) with versions that
+ * count calls once alloc_count_start has been called. Build with
+ * -DCOUNT_ALLOCS to have awesome report the count (make awesome_allocs).
+ */
+void alloc_count_start(void);
+long alloc_count(void);
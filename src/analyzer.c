@@ -0,0 +1,1082 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+#define _GNU_SOURCE
+#include <complex.h>
+#include <fftw3.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "shared.h"
+#include "analyzer.h"
+#include "arena.h"
+#include "bank.h"
+#include "multirate.h"
+#include "goertzel.h"
+#include "cqt.h"
+#include "pool.h"
+#include "bankf.h"
+#include "bankq.h"
+
+
+/* What is the input sample rate, unless the config says otherwise */
+#define SAMPLE_RATE 44100
+/* How to quantize one second. By default each hop is sample_rate/TIME
+ * samples. */
+#define TIME 10
+
+/*
+ * What is the minimun energy to care about a note 
+ */
+#define MINIMUM_ENERGY 1e9
+
+#define LEN(x) (sizeof(x)/sizeof(x[0]))
+
+char * const kernel_names[] = {"libm", "rotator", "table", "simd", "block", "multirate", "goertzel", "cqt", "float", "fixed"};
+
+/* Alignment (in bytes) of each filter's sin/cos table */
+#define TABLE_ALIGN 64
+
+/*
+ * Address space reserved for each analyzer's arena. Only what the session
+ * actually uses becomes resident, and analyzer_create gives back the rest.
+ */
+#define ARENA_RESERVE ((size_t)256 << 20)
+
+/* Say something about what analyzer_create is doing, if anyone asked */
+static void analyzer_log(FILE * log, const char * fmt, ...) {
+	va_list ap;
+	if (!log) {
+		return;
+	}
+	va_start(ap, fmt);
+	vfprintf(log, fmt, ap);
+	va_end(ap);
+}
+
+/*
+ * THEORY OF OPERATION
+ *
+ * Consutrct one "filter" for every note that we want to recognize. 
+ * We compute the running projection of each new sample into a sine and
+ * cosine wave of each note. (This is essentially like taking a fourier
+ * transofrm but we're only interested in certain notes.)
+ *
+ * We keep a running "total" of the sin and cos part but we decimate
+ * decrease it (by a small factor) each sample to keep things current.
+ *
+ * We can then pick out which notes are present by finding the notes
+ * with the highest relative energy defines by the sum of the squares
+ * of the sine and cosine parts.
+ */
+typedef struct FILTER{
+	/* What is the frequency of this note in Hz */
+	double freq;
+	/* What is the wavelength of this note in samples */
+	int length;
+	/* What sample of the wavelength are we on */
+	int index;
+	/* What factor do we decimate by on each sample */
+	double rolloff;
+	/* normalizer == 1/length. This adjusts for the fact that
+	 * we don't count all frequencies fairly. (lower frequencies are
+	 * "longer" and accumulate more energy... Is this right?)
+	 */
+	double normalizer;
+
+	/* What do we call this note */
+	char name[32];
+
+	/* Projected amplitue onto the sine and cosine waves */
+	double xsin;
+	double xcos;
+
+	/* Rotator kernel: current phase as a unit phasor and the rotation
+	 * applied to it on every sample */
+	double psin;
+	double pcos;
+	double dsin;
+	double dcos;
+
+	/* Table kernel: |length| interleaved (sin, cos) pairs, one per index */
+	double * table;
+
+	double accumulator;
+	double max;
+	
+} FILTER;
+
+
+/* Get the total (sine + cosine) energy in a particular filter.
+ * This gets the average energy in the filter since the last time
+ * filter_energy was called, |samples| samples ago.
+ */
+double filter_energy_average(FILTER * f, int samples) {
+	double e = f->accumulator;
+	f->accumulator = 0;
+	return e * f->normalizer / samples;
+}
+
+double filter_energy_max(FILTER * f) {
+	double e = f->max;
+	f->max = 0;
+	return e * f->normalizer;
+}
+
+/* Update the energy statistics after a filter has been advanced */
+static inline void filter_accumulate(FILTER * f) {
+	double e;
+	/* Update accumulator which we will use to keep track of the
+	 * average energy over a sampl.
+	 */
+
+	e = (f->xsin*f->xsin) + (f->xcos*f->xcos);
+
+	if (e> f->max) {
+		f->max= e;
+	}
+	f->accumulator += e;
+}
+
+/* Update a filter with a new sample */
+void filter_touch(FILTER * f, double delta) {
+	/* What is the current phase angle?*/
+	double rad = 2*M_PI * (double)f->index / (double)f->length;
+	/* Update sine and cosine parts */
+	f->xsin = f->xsin * f->rolloff + delta *  sin(rad);
+	f->xcos = f->xcos * f->rolloff + delta *  cos(rad);
+	/* Update the index */
+	f->index = (f->index+1) % f->length;
+
+	filter_accumulate(f);
+}
+
+/* Update a filter with a new sample using the phase rotator */
+void filter_touch_rotator(FILTER * f, double delta) {
+	double psin = f->psin;
+	double pcos = f->pcos;
+	/* Update sine and cosine parts */
+	f->xsin = f->xsin * f->rolloff + delta * psin;
+	f->xcos = f->xcos * f->rolloff + delta * pcos;
+	/* Rotate the phasor forward by one sample */
+	f->psin = psin * f->dcos + pcos * f->dsin;
+	f->pcos = pcos * f->dcos - psin * f->dsin;
+
+	filter_accumulate(f);
+}
+
+/* Update a filter with a new sample using its sin/cos table */
+void filter_touch_table(FILTER * f, double delta) {
+	double * t = f->table + 2 * f->index;
+	/* Update sine and cosine parts */
+	f->xsin = f->xsin * f->rolloff + delta * t[0];
+	f->xcos = f->xcos * f->rolloff + delta * t[1];
+	/* Update the index */
+	if (++f->index == f->length) {
+		f->index = 0;
+	}
+
+	filter_accumulate(f);
+}
+
+/*
+ * Advance a filter over |n| samples of silence in closed form. With no
+ * input the projection just shrinks by rolloff per sample, so its energy
+ * peaks after the first sample and the accumulator picks up a geometric
+ * series. Both the index (libm and table kernels) and the phasor
+ * (rotator) move forward.
+ */
+void filter_decay(FILTER * f, int n) {
+	double r2 = f->rolloff * f->rolloff;
+	double rn = pow(f->rolloff, n);
+	double e = (f->xsin*f->xsin) + (f->xcos*f->xcos);
+	double w = atan2(f->dsin, f->dcos) * n;
+	double s = sin(w), c = cos(w);
+	double psin = f->psin, pcos = f->pcos;
+	if (n <= 0) {
+		return;
+	}
+	if (e * r2 > f->max) {
+		f->max = e * r2;
+	}
+	f->accumulator += e * r2 * (1 - rn*rn) / (1 - r2);
+	f->xsin *= rn;
+	f->xcos *= rn;
+	f->psin = psin * c + pcos * s;
+	f->pcos = pcos * c - psin * s;
+	f->index = (f->index + n) % f->length;
+}
+
+/*
+ * Rounding error makes the rotator phasor drift off the unit circle
+ * by roughly one part in 1e16 per sample, so pull it back every so often
+ * (once per chunk is plenty).
+ */
+void filter_renormalize(FILTER * f) {
+	double mag = sqrt(f->psin*f->psin + f->pcos*f->pcos);
+	f->psin /= mag;
+	f->pcos /= mag;
+}
+
+/*
+ * Try to be clever about picking the rolloff. The idea is that for
+ * each note we'll pick a decay factor that's some big (like 20) multiple
+ * of the period in samples. The equation comes from:
+ *
+ * X_0 = v; x_n = a*x_(n-1).  Let X_n = v/2.
+ * v/2 = a*x_n-1 --> v/2 = a^n*v --> a^n = 1/2. 
+ * Therefore, a = exp(ln(1/2)/n).
+ * When we do, this we also need to introduce a normalization factor of
+ * (1-a). 
+ */
+double halflife_to_rolloff(double halflife) {
+	return exp(-.6931/halflife);
+}
+
+/*
+ * What normalization factor do we need to apply during filter_energy
+ * to compensate for the decay factor above?
+ *
+ * This comes from:  x_n == a(x_(n-1)) +v.
+ * But in the steady state, we have x_n==x_(n-1) so
+ * x_n = a*(x_n) + v --> x_n = v/(1-a). 
+ *
+ * The factor of 1000 is essentially arbitrary but is calibrated against
+ * some cutoffs in other code and generally makes the normalizing factors
+ * close to 1.0
+ */
+double normalizer_from_rolloff(double rolloff) {
+	return 1000 * (1 - rolloff);
+}
+
+/*
+ * Setup a bunch of filters (in |arena|) from a table of notes. Each
+ * octave has |bins| filters, bins/notes of them spread evenly around every
+ * note (one right on it if that's odd). The lowest octave starts at |base|
+ * rather than note_table[0].
+ */
+FILTER * make_filters(ARENA * arena,
+	double * note_table,
+	char ** names,
+	int notes,
+	int bins,
+	int octaves,
+	double base,
+	double sample_freq) {
+
+	int space = bins * octaves;
+	int per_note = bins / notes;
+	int n,o,j;
+
+	/* Current octave multiplyer */
+	double mult = base / note_table[0];
+	FILTER * fs;
+	fs = (FILTER*)arena_alloc(arena, sizeof(*fs) * space);
+
+	/* Loop over each bin of each note of each octave */
+	for (o = 0; o < octaves; o++) {
+		for (n = 0; n < notes; n++) for (j = 0; j < per_note; j++) {
+			/* Built filter structure for this bin */
+			int len;
+			double freq;
+			FILTER * cur;
+			/* How far off the note is it, in bins? */
+			double offset = j - (per_note - 1) / 2.0;
+			/* What is the frequency of this bin? */
+			freq = mult * note_table[n] * pow(2, offset / bins);
+			/* What is the "wavelength" measure in samples */
+			len = sample_freq / freq;
+			/* What is the fs object that we're setting up */
+			cur = fs+(n * per_note + j + bins *o);
+			cur->freq = freq;
+			cur->length = len;
+			cur->index = 0;
+			cur->psin = 0;
+			cur->pcos = 1;
+			cur->dsin = sin(2*M_PI * freq / sample_freq);
+			cur->dcos = cos(2*M_PI * freq / sample_freq);
+			cur-> rolloff = halflife_to_rolloff(len*16);
+		//	cur-> rolloff = halflife_to_rolloff(8 * sample_freq / TIME);
+			cur->normalizer = normalizer_from_rolloff(cur->rolloff);
+			if (offset == 0) {
+				snprintf(cur->name, sizeof(cur->name), "%i%s", o, names[n]);
+			} else {
+				snprintf(cur->name, sizeof(cur->name), "%i%s%+g", o, names[n], offset);
+			}
+	//		fprintf(stderr, "%s: %f %f %f %i (%i:%i)\n",
+	//			cur->name, freq, cur->rolloff, cur->normalizer, len, o, n);
+		}
+		/* Don't forget to udpate the octave! */
+		mult*=2.0;
+	}
+
+	return fs;
+}
+
+/*
+ * Build the sin/cos tables used by KERNEL_TABLE. Every filter's table
+ * lives in a single block, each one starting on a cache line, so the
+ * whole bank (a couple of hundred KB for 5 octaves) stays in L2.
+ * Reports the footprint per octave to |log|.
+ */
+void build_filter_tables(ARENA * arena, FILTER * fs, int notes, int octaves, FILE * log) {
+	int o, n, i;
+	size_t total = 0;
+	size_t pos = 0;
+	double * block;
+
+	/* Size each table rounded up to a whole number of cache lines */
+	for (i = 0; i < notes * octaves; i++) {
+		size_t bytes = fs[i].length * 2 * sizeof(double);
+		total += (bytes + TABLE_ALIGN - 1) / TABLE_ALIGN * TABLE_ALIGN;
+	}
+	/* Arena allocations already start on a cache line */
+	block = (double*)arena_alloc(arena, total);
+
+	for (o = 0; o < octaves; o++) {
+		size_t octave_start = pos;
+		for (n = 0; n < notes; n++) {
+			FILTER * cur = fs + (n + notes * o);
+			size_t bytes = cur->length * 2 * sizeof(double);
+			cur->table = block + pos / sizeof(double);
+			for (i = 0; i < cur->length; i++) {
+				double rad = 2*M_PI * (double)i / (double)cur->length;
+				cur->table[2*i] = sin(rad);
+				cur->table[2*i+1] = cos(rad);
+			}
+			pos += (bytes + TABLE_ALIGN - 1) / TABLE_ALIGN * TABLE_ALIGN;
+		}
+		analyzer_log(log, "TABLES: octave %i: %zu bytes (total %zu)\n",
+			o, pos - octave_start, pos);
+	}
+}
+
+/*
+ * Update an entire filter bank with a new sample */
+void  update_filters(FILTER * fs, int n, double s, KERNEL kernel) {
+	int i;
+	switch (kernel) {
+	case KERNEL_LIBM:
+		for (i = 0; i < n; i++) {
+			filter_touch(fs+i, s);
+		}
+		break;
+	case KERNEL_ROTATOR:
+		for (i = 0; i < n; i++) {
+			filter_touch_rotator(fs+i, s);
+		}
+		break;
+	case KERNEL_TABLE:
+		for (i = 0; i < n; i++) {
+			filter_touch_table(fs+i, s);
+		}
+		break;
+	case KERNEL_SIMD:
+	case KERNEL_BLOCK:
+	case KERNEL_MULTIRATE:
+	case KERNEL_GOERTZEL:
+	case KERNEL_CQT:
+	case KERNEL_FLOAT:
+	case KERNEL_FIXED:
+		/* Runs on a BANK, GOERTZEL, CQT, BANKF or BANKQ, see engine_advance */
+		break;
+	}
+}
+
+/* Guess which note (ignoring octave) are present 
+ * |energy| an array of octaves*bins filter energies (see engine_energies)
+ * |notes_present| a pre-allocated array of ints. notes that are present will be set to 1
+ * With more than one bin per note, the energies of a note's bins are
+ * added up first.
+ * */
+double filter_guess_notes(double * energy,
+	int notes,
+	int bins,
+	int octaves,
+	int *notes_present) {
+
+	int i;
+	double total_energy = 0;
+	int n = bins * octaves;
+	int per_note = bins / notes;
+	int note, octave, j;
+
+	/* Clear notes */
+	memset(notes_present, 0, sizeof(*notes_present) * notes);
+
+	/* Accumulate the total energy.
+	 * XXX: Is this right? Do we want to use the combined energy of all
+	 * filters or the current sample energy???
+	 */
+	for (i = 0; i < n; i++) {
+		total_energy += energy[i];
+	}
+
+	total_energy *=1;
+	/* Iterate over all notes.  Mark notes that have enough energy. */
+	for (octave = 0; octave < octaves; octave ++) {
+		for (note = 0; note < notes; note++) {
+			double e = 0;
+			for (j = 0; j < per_note; j++) {
+				e += energy[note * per_note + j + bins * octave];
+			}
+			/* Count something as a note if it has at last
+			 * 1/10 of the energy as well as a minimum energy
+			 */
+			if (e > total_energy / 10 && e > MINIMUM_ENERGY) {
+				notes_present[note] = 1;
+			}
+		}
+	}
+	return total_energy;
+}
+
+/*
+ * Process a bunch of samples.  There is a high system-call overhead to
+ * getting samples so we don't retrieve samples one at a time. Instead, 
+ * loop2, will retrieve them at the display-update rate. process_chunk will
+ * loop through every sample ina chunk and update its filter bank. 
+ */
+void process_chunk(const double * x, int samples, FILTER * fs, int n_filter, KERNEL kernel) {
+	int i;
+	for (i = 0; i < samples; i++) {
+		update_filters(fs, n_filter, x[i], kernel);
+	}
+	if (kernel == KERNEL_ROTATOR) {
+		for (i = 0; i < n_filter; i++) {
+			filter_renormalize(fs+i);
+		}
+	}
+}
+
+/*
+ * Build one BANK per octave (of |bins| filters) for KERNEL_MULTIRATE.
+ * Octave |o| runs at 1/2^levels[o] of the sample rate, picked to suit its
+ * highest filter. Each filter keeps the same half-life in seconds as in
+ * make_filters, so its rolloff per decimated sample is rolloff^d. Fewer
+ * samples per half-life means the filter accumulates d times less energy,
+ * so the normalizer is scaled by d to keep filter_energy_max on the same
+ * scale as the full-rate bank.
+ */
+void make_octave_banks(ARENA * arena, FILTER * fs, BANK ** banks, int * levels,
+	int bins,
+	int octaves,
+	double sample_freq,
+	FILE * log) {
+
+	int n, o;
+	for (o = 0; o < octaves; o++) {
+		int d;
+		double rate;
+		levels[o] = multirate_pick_level(fs[bins * o + bins - 1].freq, sample_freq);
+		d = 1 << levels[o];
+		rate = sample_freq / d;
+		banks[o] = bank_create(arena, bins);
+		for (n = 0; n < bins; n++) {
+			FILTER * cur = fs + (n + bins * o);
+			double freq = cur->freq;
+			double rolloff = pow(cur->rolloff, d);
+			bank_set_filter(banks[o], n,
+				sin(2*M_PI * freq / rate), cos(2*M_PI * freq / rate),
+				rolloff, normalizer_from_rolloff(rolloff) * d);
+		}
+		analyzer_log(log, "MULTIRATE: octave %i at %.0fHz\n", o, rate);
+	}
+}
+
+/*
+ * FFTW's planner isn't thread safe (executing a plan is), so creating and
+ * destroying a KERNEL_CQT engine holds this.
+ */
+static pthread_mutex_t planner_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * A filter bank together with the kernel that drives it. The AoS kernels
+ * work on the FILTER array directly, KERNEL_SIMD and KERNEL_BLOCK on a
+ * BANK copy of it.
+ */
+typedef struct {
+	KERNEL kernel;
+	/* bins * octaves filters, octave by octave */
+	int bins;
+	int octaves;
+	int n_filter;
+	FILTER * fs;
+	BANK * bank;
+	/* The current hop converted to doubles */
+	double * block;
+	/* KERNEL_MULTIRATE: decimators and one bank per octave */
+	MULTIRATE * multirate;
+	BANK * octave_bank[MAX_OCTAVES];
+	int octave_level[MAX_OCTAVES];
+	/* KERNEL_GOERTZEL */
+	GOERTZEL * goertzel;
+	/* KERNEL_CQT */
+	CQT * cqt;
+	/* KERNEL_BLOCK split across threads */
+	POOL * pool;
+	/* KERNEL_FLOAT, and the block converted to float for it */
+	BANKF * bankf;
+	float * fblock;
+	/* KERNEL_FIXED, and the block converted back to 16 bit for it */
+	BANKQ * bankq;
+	int16_t * qblock;
+	/* What the input looks like and how many frames we analyze at a
+	 * time */
+	FORMAT format;
+	int hop;
+	/* Silence gate (see ANALYZER_CONFIG) and how many hops it has
+	 * skipped */
+	double gate;
+	long hops;
+	long gated;
+} ENGINE;
+
+/*
+ * Start the worker threads for a threaded KERNEL_BLOCK engine. Either
+ * give each worker whole octaves, or split the filters evenly.
+ */
+void make_engine_pool(ARENA * arena, ENGINE * e, const ANALYZER_CONFIG * c) {
+	int threads = c->threads;
+	int first[threads];
+	int count[threads];
+	int i;
+	if (c->by_octave && threads > e->octaves) {
+		analyzer_log(c->log, "THREADS: only %i octaves to go around\n", e->octaves);
+		threads = e->octaves;
+	}
+	if (threads > e->n_filter) {
+		threads = e->n_filter;
+	}
+	for (i = 0; i < threads; i++) {
+		int units = c->by_octave ? e->octaves : e->n_filter;
+		int size = c->by_octave ? e->bins : 1;
+		int lo = units * i / threads;
+		int hi = units * (i+1) / threads;
+		first[i] = lo * size;
+		count[i] = (hi - lo) * size;
+	}
+	e->pool = pool_create(arena, e->bank, c->isa, threads, first, count);
+	analyzer_log(c->log, "THREADS: %i workers\n", threads);
+}
+
+/*
+ * Stop an engine's threads and drop its FFTW plan, including one that
+ * make_engine only got part way through. Its memory goes with the arena.
+ */
+void engine_destroy(ENGINE * e) {
+	if (e->pool) {
+		pool_destroy(e->pool);
+	}
+	if (e->cqt) {
+		pthread_mutex_lock(&planner_lock);
+		cqt_destroy(e->cqt);
+		pthread_mutex_unlock(&planner_lock);
+	}
+}
+
+/*
+ * Build an engine in |arena|. Returns NULL (and says why in c->log) if |c|
+ * asks for the impossible.
+ */
+ENGINE * make_engine(ARENA * arena, const ANALYZER_CONFIG * c) {
+	ENGINE * e;
+	KERNEL kernel = c->kernel;
+	int i;
+	e = (ENGINE*)arena_alloc(arena, sizeof(*e));
+	e->kernel = kernel;
+	e->format = c->format;
+	e->hop = c->format.sample_rate * c->hop_ms / 1000;
+	/* The Goertzel and CQT engines have nothing that decays */
+	e->gate = (kernel == KERNEL_GOERTZEL || kernel == KERNEL_CQT) ? -1 : c->gate;
+	e->bins = c->bins;
+	e->octaves = c->octaves;
+	e->n_filter = e->bins * e->octaves;
+	e->fs = make_filters(arena, note_table, note_names, LEN(note_table), e->bins, e->octaves,
+		c->base, e->format.sample_rate);
+	if (kernel == KERNEL_TABLE) {
+		build_filter_tables(arena, e->fs, e->bins, e->octaves, c->log);
+	}
+	if (kernel == KERNEL_SIMD || kernel == KERNEL_BLOCK) {
+		e->bank = bank_create(arena, e->n_filter);
+		for (i = 0; i < e->n_filter; i++) {
+			FILTER * f = e->fs + i;
+			bank_set_filter(e->bank, i, f->dsin, f->dcos, f->rolloff, f->normalizer);
+		}
+		if (bank_select_isa(e->bank, c->isa) < 0) {
+			analyzer_log(c->log, "UNSUPPORTED ISA: %s\n", c->isa);
+			engine_destroy(e);
+			return NULL;
+		}
+		analyzer_log(c->log, "BANK: %i filters using %s\n", e->n_filter, e->bank->isa);
+	}
+	/* Every hop is converted to doubles here first */
+	e->block = (double*)arena_alloc(arena, sizeof(*e->block) * e->hop);
+	if (kernel == KERNEL_FLOAT) {
+		e->bankf = bankf_create(arena, e->n_filter);
+		for (i = 0; i < e->n_filter; i++) {
+			FILTER * f = e->fs + i;
+			bankf_set_filter(e->bankf, i, f->dsin, f->dcos, f->rolloff, f->normalizer);
+		}
+		e->fblock = (float*)arena_alloc(arena, sizeof(*e->fblock) * e->hop);
+		analyzer_log(c->log, "BANK: %i filters in single precision\n", e->n_filter);
+	}
+	if (kernel == KERNEL_FIXED) {
+		e->bankq = bankq_create(arena, e->n_filter);
+		for (i = 0; i < e->n_filter; i++) {
+			FILTER * f = e->fs + i;
+			bankq_set_filter(e->bankq, i, f->freq, e->format.sample_rate,
+				f->rolloff, f->normalizer);
+		}
+		e->qblock = (int16_t*)arena_alloc(arena, sizeof(*e->qblock) * e->hop);
+		analyzer_log(c->log, "BANK: %i filters in fixed point\n", e->n_filter);
+	}
+	if (kernel == KERNEL_BLOCK && c->threads > 0) {
+		make_engine_pool(arena, e, c);
+	}
+	if (kernel == KERNEL_MULTIRATE) {
+		int levels = 0;
+		make_octave_banks(arena, e->fs, e->octave_bank, e->octave_level,
+			e->bins, e->octaves, e->format.sample_rate, c->log);
+		for (i = 0; i < e->octaves; i++) {
+			if (e->octave_level[i] > levels) {
+				levels = e->octave_level[i];
+			}
+			if (bank_select_isa(e->octave_bank[i], c->isa) < 0) {
+				analyzer_log(c->log, "UNSUPPORTED ISA: %s\n", c->isa);
+				engine_destroy(e);
+				return NULL;
+			}
+		}
+		e->multirate = multirate_create(arena, levels, e->hop);
+	}
+	if (kernel == KERNEL_GOERTZEL) {
+		/*
+		 * A steady sine of amplitude A gives |X|^2 = (A*N/2)^2 over N
+		 * samples, while the filter settles at (A/2)^2/(1-rolloff)^2
+		 * before normalization. Scale so both report the same energy
+		 * and the filter_guess_notes thresholds still apply.
+		 */
+		e->goertzel = goertzel_create(arena, e->n_filter);
+		for (i = 0; i < e->n_filter; i++) {
+			FILTER * f = e->fs + i;
+			goertzel_set_bin(e->goertzel, i, 2*M_PI * f->freq / e->format.sample_rate,
+				f->normalizer / ((1 - f->rolloff) * (1 - f->rolloff)));
+		}
+	}
+	if (kernel == KERNEL_CQT) {
+		/* Same scaling as KERNEL_GOERTZEL: a sine gives |CQ| = A/2 */
+		double freqs[e->n_filter];
+		double scale[e->n_filter];
+		for (i = 0; i < e->n_filter; i++) {
+			FILTER * f = e->fs + i;
+			freqs[i] = f->freq;
+			scale[i] = f->normalizer / ((1 - f->rolloff) * (1 - f->rolloff));
+		}
+		pthread_mutex_lock(&planner_lock);
+		e->cqt = cqt_create(arena, freqs, scale, e->n_filter, e->format.sample_rate,
+			c->planner_flags);
+		pthread_mutex_unlock(&planner_lock);
+		analyzer_log(c->log, "CQT: %i notes, %i point FFT, %i kernel entries\n",
+			e->cqt->n, e->cqt->fft_size, e->cqt->start[e->cqt->n]);
+	}
+	return e;
+}
+
+/*
+ * Advance the filters over |n| samples of silence without looking at each
+ * sample. The multirate front end still sees the real input so its delay
+ * lines stay right; what comes out of it is at least as quiet.
+ */
+void engine_decay(ENGINE * e, const double * x, int n) {
+	int i;
+	if (e->multirate) {
+		multirate_process(e->multirate, x, n);
+		for (i = 0; i < e->octaves; i++) {
+			bank_decay(e->octave_bank[i], e->multirate->count[e->octave_level[i]]);
+		}
+	} else if (e->bankf) {
+		bankf_decay(e->bankf, n);
+	} else if (e->bankq) {
+		bankq_decay(e->bankq, n);
+	} else if (e->pool) {
+		pool_decay(e->pool, n);
+	} else if (e->bank) {
+		bank_decay(e->bank, n);
+	} else {
+		for (i = 0; i < e->n_filter; i++) {
+			filter_decay(e->fs + i, n);
+		}
+	}
+}
+
+/* Run |n| converted samples through the engine */
+void engine_advance(ENGINE * e, const double * x, int n) {
+	int i;
+	e->hops++;
+	if (e->gate >= 0) {
+		double energy = 0;
+		for (i = 0; i < n; i++) {
+			energy += x[i] * x[i];
+		}
+		if (energy <= e->gate * e->gate * n) {
+			e->gated++;
+			engine_decay(e, x, n);
+			return;
+		}
+	}
+	if (e->goertzel) {
+		goertzel_process(e->goertzel, x, n);
+	} else if (e->cqt) {
+		cqt_process(e->cqt, x, n);
+	} else if (e->multirate) {
+		multirate_process(e->multirate, x, n);
+		for (i = 0; i < e->octaves; i++) {
+			int level = e->octave_level[i];
+			bank_process_block(e->octave_bank[i],
+				e->multirate->level[level], e->multirate->count[level]);
+		}
+	} else if (e->bankf) {
+		for (i = 0; i < n; i++) {
+			e->fblock[i] = x[i];
+		}
+		bankf_process_block(e->bankf, e->fblock, n);
+	} else if (e->bankq) {
+		/* 16 bit input comes back exactly; float input is clipped */
+		for (i = 0; i < n; i++) {
+			double v = x[i] < -32768 ? -32768 : x[i] > 32767 ? 32767 : x[i];
+			e->qblock[i] = lrint(v);
+		}
+		bankq_process_block(e->bankq, e->qblock, n);
+	} else if (e->pool) {
+		pool_process_block(e->pool, x, n);
+	} else if (e->kernel == KERNEL_BLOCK) {
+		bank_process_block(e->bank, x, n);
+	} else if (e->bank) {
+		bank_process(e->bank, x, n);
+	} else {
+		process_chunk(x, n, e->fs, e->n_filter, e->kernel);
+	}
+}
+
+/* Fill in |energy| with the peak energy of every filter since the last call */
+void engine_energies(ENGINE * e, double * energy) {
+	int i;
+	if (e->goertzel) {
+		goertzel_energy(e->goertzel, energy);
+		return;
+	}
+	if (e->cqt) {
+		cqt_energy(e->cqt, energy);
+		return;
+	}
+	if (e->multirate) {
+		for (i = 0; i < e->octaves; i++) {
+			bank_energy_max(e->octave_bank[i], energy + e->bins * i);
+		}
+		return;
+	}
+	if (e->bankf) {
+		bankf_energy_max(e->bankf, energy);
+		return;
+	}
+	if (e->bankq) {
+		bankq_energy_max(e->bankq, energy);
+		return;
+	}
+	if (e->pool) {
+		pool_energy_max(e->pool, energy);
+		return;
+	}
+	if (e->bank) {
+		bank_energy_max(e->bank, energy);
+		return;
+	}
+	for (i = 0; i < e->n_filter; i++) {
+		energy[i] = filter_energy_max(e->fs+i);
+	}
+}
+
+/* Forget all input, so the engine can start on a new stream */
+void engine_reset(ENGINE * e) {
+	int i;
+	if (e->goertzel) {
+		goertzel_reset(e->goertzel);
+	}
+	if (e->cqt) {
+		cqt_reset(e->cqt);
+	}
+	if (e->multirate) {
+		multirate_reset(e->multirate);
+		for (i = 0; i < e->octaves; i++) {
+			bank_reset(e->octave_bank[i]);
+		}
+	}
+	if (e->bankf) {
+		bankf_reset(e->bankf);
+	}
+	if (e->bankq) {
+		bankq_reset(e->bankq);
+	}
+	if (e->pool) {
+		pool_reset(e->pool);
+	}
+	if (e->bank) {
+		bank_reset(e->bank);
+	}
+	for (i = 0; i < e->n_filter; i++) {
+		FILTER * f = e->fs + i;
+		f->index = 0;
+		f->xsin = 0;
+		f->xcos = 0;
+		f->psin = 0;
+		f->pcos = 1;
+		f->accumulator = 0;
+		f->max = 0;
+	}
+}
+
+/*
+ * THE LIBRARY
+ *
+ * An ANALYZER is one ENGINE per stream (see MIX), the hop they are
+ * filling and a queue of results waiting to be polled. Input arrives in
+ * whatever pieces the caller likes and is split into the streams in one
+ * pass; every complete hop runs through each stream's engine and leaves
+ * one ANALYZER_RESULT per stream behind.
+ *
+ * All of it, this struct included, lives in one ARENA that is sealed once
+ * analyzer_create is done, so pushing and polling never allocate.
+ */
+struct ANALYZER {
+	ARENA * arena;
+	/* Arena bytes taken by each stream's engine */
+	size_t stream_bytes;
+	MIX mix;
+	int streams;
+	ENGINE ** e;
+	/* Frames of the current hop already in each e[s]->block */
+	int fill;
+	/* Circular queue of results, stream by stream within each hop */
+	ANALYZER_RESULT * queue;
+	int queue_size;
+	int head;
+	int queued;
+};
+
+/* Which kernel is called |name|? -1 if none is. */
+int analyzer_kernel(const char * name) {
+	int i;
+	for (i = 0; i < LEN(kernel_names); i++) {
+		if (!strcmp(name, kernel_names[i])) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* What awesome does with no arguments */
+void analyzer_config_default(ANALYZER_CONFIG * c) {
+	memset(c, 0, sizeof(*c));
+	c->kernel = KERNEL_ROTATOR;
+	c->isa = "auto";
+	c->format.sample_rate = SAMPLE_RATE;
+	c->format.channels = 2;
+	c->format.sample_format = SAMPLE_S16;
+	c->mix = MIX_LEFT;
+	c->bins = LEN(note_table);
+	c->octaves = OCTAVES;
+	c->base = note_table[0];
+	c->hop_ms = 1000 / TIME;
+	c->gate = -1;
+	c->threads = 0;
+	c->by_octave = 0;
+	c->planner_flags = FFTW_ESTIMATE;
+	c->queue = 16;
+	c->log = NULL;
+}
+
+/* Returns NULL (and says why in c->log) if the config makes no sense */
+ANALYZER * analyzer_create(const ANALYZER_CONFIG * c) {
+	ANALYZER * a;
+	ANALYZER_CONFIG quiet = *c;
+	ARENA * arena;
+	int s;
+	if (c->kernel < 0 || c->kernel >= LEN(kernel_names)) {
+		analyzer_log(c->log, "UNKNOWN KERNEL: %i\n", c->kernel);
+		return NULL;
+	}
+	/* The top octave goes up to ~2kHz */
+	if (c->format.sample_rate < 8000 || c->format.channels < 1) {
+		analyzer_log(c->log, "BAD FORMAT: %iHz, %i channels\n",
+			c->format.sample_rate, c->format.channels);
+		return NULL;
+	}
+	/* Every filter has to be below the Nyquist frequency */
+	if (c->bins < 1 || c->bins > MAX_BINS || c->bins % LEN(note_table)
+			|| c->octaves < 1 || c->octaves > MAX_OCTAVES || c->base <= 0
+			|| c->base * pow(2, c->octaves) >= c->format.sample_rate / 2) {
+		analyzer_log(c->log, "BAD BANK: %i bins x %i octaves from %gHz\n",
+			c->bins, c->octaves, c->base);
+		return NULL;
+	}
+	if (mix_streams(&c->format, c->mix) < 0) {
+		analyzer_log(c->log, "BAD MIX: needs two channels\n");
+		return NULL;
+	}
+	if (c->hop_ms < 1 || c->hop_ms > 1000 || c->queue < 1) {
+		analyzer_log(c->log, "BAD HOP: %ims\n", c->hop_ms);
+		return NULL;
+	}
+	arena = arena_create(ARENA_RESERVE);
+	a = (ANALYZER*)arena_alloc(arena, sizeof(*a));
+	a->arena = arena;
+	a->mix = c->mix;
+	a->streams = mix_streams(&c->format, c->mix);
+	a->e = (ENGINE**)arena_alloc(arena, a->streams * sizeof(*a->e));
+	/* Every stream's engine is the same, so only describe the first */
+	quiet.log = NULL;
+	for (s = 0; s < a->streams; s++) {
+		size_t before = arena->used;
+		a->e[s] = make_engine(arena, s == 0 ? c : &quiet);
+		if (!a->e[s]) {
+			analyzer_destroy(a);
+			return NULL;
+		}
+		a->stream_bytes = arena->used - before;
+	}
+	a->queue_size = c->queue * a->streams;
+	a->queue = (ANALYZER_RESULT*)arena_alloc(arena, a->queue_size * sizeof(*a->queue));
+	arena_seal(arena);
+	analyzer_log(c->log, "ARENA: %zu bytes in %li allocations, %zu per stream\n",
+		arena->used, arena->allocs, a->stream_bytes);
+	return a;
+}
+
+/* Every e[s]->block is full: run them and queue up what we make of them */
+static void analyzer_run_hop(ANALYZER * a) {
+	int s;
+	for (s = 0; s < a->streams; s++) {
+		ENGINE * e = a->e[s];
+		ANALYZER_RESULT * r = a->queue + (a->head + a->queued) % a->queue_size;
+		r->hop = e->hops;
+		r->stream = s;
+		engine_advance(e, e->block, e->hop);
+		engine_energies(e, r->energy);
+		r->total_energy = filter_guess_notes(r->energy, LEN(note_table), e->bins,
+			e->octaves, r->notes_present);
+		a->queued++;
+	}
+	a->fill = 0;
+}
+
+/*
+ * Feed |n| frames of input (in the config's format) to the analyzer.
+ * Returns how many it took, which is less than |n| only if the result
+ * queue filled up; poll and push the rest.
+ */
+int analyzer_push(ANALYZER * a, const void * frames, int n) {
+	const FORMAT * f = &a->e[0]->format;
+	const char * in = (const char*)frames;
+	int frame_bytes = format_frame_bytes(f);
+	int hop = a->e[0]->hop;
+	double * out[a->streams];
+	int used = 0;
+	int s;
+	while (used < n && a->queued + a->streams <= a->queue_size) {
+		int take = hop - a->fill;
+		if (take > n - used) {
+			take = n - used;
+		}
+		for (s = 0; s < a->streams; s++) {
+			out[s] = a->e[s]->block + a->fill;
+		}
+		format_split(f, a->mix, in + (size_t)used * frame_bytes, out, take);
+		a->fill += take;
+		used += take;
+		if (a->fill == hop) {
+			analyzer_run_hop(a);
+		}
+	}
+	return used;
+}
+
+/* Take the oldest waiting result. Returns 0 if there isn't one. */
+int analyzer_poll(ANALYZER * a, ANALYZER_RESULT * r) {
+	if (a->queued == 0) {
+		return 0;
+	}
+	*r = a->queue[a->head];
+	a->head = (a->head + 1) % a->queue_size;
+	a->queued--;
+	return 1;
+}
+
+/* Frames of input per result */
+int analyzer_hop(ANALYZER * a) {
+	return a->e[0]->hop;
+}
+
+/* Results per hop */
+int analyzer_streams(ANALYZER * a) {
+	return a->streams;
+}
+
+/*
+ * Two analyzers fed the same input from different starting points agree
+ * (once the older input has decayed away) only if they started a whole
+ * number of periods apart. The decimators in KERNEL_MULTIRATE keep every
+ * other sample, so for it that's 2^levels frames; otherwise it's 1.
+ */
+int analyzer_period(ANALYZER * a) {
+	ENGINE * e = a->e[0];
+	return e->multirate ? 1 << e->multirate->levels : 1;
+}
+
+/* Counts are summed over the streams */
+void analyzer_stats(ANALYZER * a, ANALYZER_STATS * st) {
+	int s;
+	memset(st, 0, sizeof(*st));
+	for (s = 0; s < a->streams; s++) {
+		st->hops += a->e[s]->hops;
+		st->gated += a->e[s]->gated;
+	}
+	st->gate = a->e[0]->gate;
+	st->bytes = a->arena->used;
+	st->stream_bytes = a->stream_bytes;
+}
+
+/* Forget all input and results, so the analyzer can start on a new stream */
+void analyzer_reset(ANALYZER * a) {
+	int s;
+	for (s = 0; s < a->streams; s++) {
+		engine_reset(a->e[s]);
+		a->e[s]->hops = 0;
+		a->e[s]->gated = 0;
+	}
+	a->fill = 0;
+	a->head = 0;
+	a->queued = 0;
+}
+
+void analyzer_destroy(ANALYZER * a) {
+	int s;
+	for (s = 0; s < a->streams; s++) {
+		if (a->e[s]) {
+			engine_destroy(a->e[s]);
+		}
+	}
+	arena_destroy(a->arena);
+}
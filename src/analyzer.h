@@ -0,0 +1,184 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+#include <stdio.h>
+#include "format.h"
+
+/*
+ * The note analyzer as a library. A context owns one filter bank (or
+ * Goertzel or CQT engine) and everything it needs, so any number of
+ * streams can be analyzed in one process, each context on its own
+ * thread. A context itself must only be used by one thread at a time.
+ *
+ *   ANALYZER_CONFIG c;
+ *   analyzer_config_default(&c);
+ *   a = analyzer_create(&c);
+ *   while (there is input) {
+ *           used = analyzer_push(a, frames, n);
+ *           while (analyzer_poll(a, &r)) {
+ *                   ... r.notes_present of r.stream ...
+ *           }
+ *           (push whatever wasn't used again)
+ *   }
+ *   analyzer_destroy(a);
+ *
+ * Nothing here reads or writes stdin or stdout, and the only state shared
+ * between contexts is read-only tables and the lock around FFTW planning
+ * (KERNEL_CQT). Each context keeps everything in one arena (see arena.h)
+ * and allocates nothing once analyzer_create returns; worker threads and
+ * FFTW plans are the only things outside it.
+ */
+
+/*
+ * How many octaves will we consider? 
+ */
+#define OCTAVES 5
+
+/*
+ * Largest bank analyzer_create will build: filters per octave (a multiple
+ * of the 12 notes) and octaves.
+ */
+#define MAX_BINS 48
+#define MAX_OCTAVES 10
+
+/*
+ * Which inner loop do we use to advance the filters?
+ *
+ * KERNEL_LIBM calls sin() and cos() for every filter on every sample and
+ * rounds each note to an integer wavelength. It is the original (slow)
+ * reference.
+ *
+ * KERNEL_ROTATOR keeps the phase of each filter as a unit phasor and
+ * advances it by complex multiplication, so a sample costs a handful of
+ * multiply-adds and no libm calls. The phase step is fractional so the
+ * note frequency is exact.
+ *
+ * KERNEL_TABLE uses the integer wavelength like KERNEL_LIBM but looks
+ * the sine and cosine up in a per-filter table built once at startup,
+ * so its output matches KERNEL_LIBM exactly.
+ *
+ * KERNEL_SIMD is KERNEL_ROTATOR on a structure-of-arrays BANK (see
+ * bank.c), updated with the widest SIMD instructions the CPU supports.
+ *
+ * KERNEL_BLOCK runs the same BANK filter-major: the chunk is converted to
+ * doubles once and each group of filters runs across all of it with its
+ * state in registers. Output is identical to KERNEL_SIMD.
+ *
+ * KERNEL_MULTIRATE runs each octave of KERNEL_BLOCK filters on a
+ * decimated copy of the input (see multirate.c), at the lowest rate that
+ * still holds the whole octave.
+ *
+ * KERNEL_GOERTZEL isn't a filter bank at all: it computes the DFT of each
+ * chunk at every note frequency with the Goertzel recurrence (see
+ * goertzel.c). There is no smoothing between chunks, which is fine for
+ * batch jobs and cheaper than any of the filters.
+ *
+ * KERNEL_CQT is a constant-Q transform built on FFTW (see cqt.c): one FFT
+ * per chunk and a sparse kernel mapping FFT bins to notes, so its cost
+ * grows as N log N rather than with the number of filters.
+ *
+ * KERNEL_FLOAT is KERNEL_BLOCK in single precision (see bankf.c): twice
+ * the filters per vector and half the memory. Check it against the double
+ * bank with -validate.
+ *
+ * KERNEL_FIXED is the same filter bank in integer arithmetic (see
+ * bankq.c) for machines without fast floating point. Its energies come
+ * back in the same units as the double bank, so MINIMUM_ENERGY holds.
+ */
+typedef enum {
+	KERNEL_LIBM,
+	KERNEL_ROTATOR,
+	KERNEL_TABLE,
+	KERNEL_SIMD,
+	KERNEL_BLOCK,
+	KERNEL_MULTIRATE,
+	KERNEL_GOERTZEL,
+	KERNEL_CQT,
+	KERNEL_FLOAT,
+	KERNEL_FIXED,
+} KERNEL;
+
+extern char * const kernel_names[];
+
+typedef struct {
+	KERNEL kernel;
+	/* Instruction set for the BANK kernels ("auto" picks the best one) */
+	char * isa;
+	/* What the pushed frames look like, and which channels to analyze
+	 * (one result per hop for each stream MIX makes) */
+	FORMAT format;
+	MIX mix;
+	/* Filters per octave (12, or a multiple of it spaced evenly around
+	 * each note), how many octaves, and the frequency of the lowest C
+	 * (shifting it retunes the whole bank) */
+	int bins;
+	int octaves;
+	double base;
+	/* Milliseconds of input per result */
+	int hop_ms;
+	/* Skip the filter loop for hops whose RMS level is at most this
+	 * (in 16 bit units, 0 == only digital silence, -1 == never) */
+	double gate;
+	/* Split KERNEL_BLOCK across this many worker threads (0 == none),
+	 * giving each whole octaves or an equal range of filters */
+	int threads;
+	int by_octave;
+	/* FFTW planner flags (KERNEL_CQT) */
+	unsigned planner_flags;
+	/* How many results can wait to be polled. analyzer_push stops
+	 * taking input when they're all full. */
+	int queue;
+	/* Where to describe what was built and why analyzer_create failed
+	 * (NULL == nowhere) */
+	FILE * log;
+} ANALYZER_CONFIG;
+
+/* What the analyzer makes of one hop */
+typedef struct {
+	/* Hops since the analyzer was created or reset, counting from 0,
+	 * and which stream: 0, or the channel for MIX_EACH */
+	long hop;
+	int stream;
+	/* Which of the 12 notes are present, whatever the bins per octave */
+	int notes_present[12];
+	/* Peak energy of every filter over the hop (bin + bins * octave, only
+	 * the first bins * octaves are used), and their sum */
+	double energy[MAX_BINS * MAX_OCTAVES];
+	double total_energy;
+} ANALYZER_RESULT;
+
+typedef struct {
+	/* Hops analyzed, and how many of them the silence gate skipped,
+	 * counting each stream separately */
+	long hops;
+	long gated;
+	/* The gate in effect (-1 if off or the kernel has none) */
+	double gate;
+	/* Memory held by the context, and how much of it each stream's
+	 * engine takes (the rest is the result queue and bookkeeping) */
+	size_t bytes;
+	size_t stream_bytes;
+} ANALYZER_STATS;
+
+typedef struct ANALYZER ANALYZER;
+
+int analyzer_kernel(const char * name);
+void analyzer_config_default(ANALYZER_CONFIG * c);
+ANALYZER * analyzer_create(const ANALYZER_CONFIG * c);
+int analyzer_push(ANALYZER * a, const void * frames, int n);
+int analyzer_poll(ANALYZER * a, ANALYZER_RESULT * r);
+int analyzer_hop(ANALYZER * a);
+int analyzer_streams(ANALYZER * a);
+int analyzer_period(ANALYZER * a);
+void analyzer_stats(ANALYZER * a, ANALYZER_STATS * s);
+void analyzer_reset(ANALYZER * a);
+void analyzer_destroy(ANALYZER * a);
@@ -0,0 +1,77 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+static size_t round_up(size_t n, size_t to) {
+	return (n + to - 1) / to * to;
+}
+
+/*
+ * Reserve |reserve| bytes of address space. Nothing is resident until it
+ * is handed out and touched, so reserving generously is cheap.
+ */
+ARENA * arena_create(size_t reserve) {
+	ARENA * a;
+	char * base;
+	reserve = round_up(reserve, sysconf(_SC_PAGESIZE));
+	base = mmap(NULL, reserve, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) {
+		abort();
+	}
+	/* The header lives at the front of its own arena */
+	a = (ARENA*)base;
+	a->base = base;
+	a->size = reserve;
+	a->used = round_up(sizeof(*a), ARENA_ALIGN);
+	a->allocs = 0;
+	a->sealed = 0;
+	return a;
+}
+
+/* |bytes| of zeroed memory. Never fails: running out is a bug. */
+void * arena_alloc(ARENA * a, size_t bytes) {
+	void * p;
+	if (a->sealed) {
+		fprintf(stderr, "ARENA: %zu byte allocation after the session was built\n", bytes);
+		abort();
+	}
+	if (bytes > a->size - a->used) {
+		fprintf(stderr, "ARENA: out of space (%zu of %zu bytes used)\n", a->used, a->size);
+		abort();
+	}
+	/* Fresh pages are zero and nothing is ever reused */
+	p = a->base + a->used;
+	a->used += round_up(bytes, ARENA_ALIGN);
+	a->allocs++;
+	return p;
+}
+
+/* The session is built: give back the reservation it didn't use */
+void arena_seal(ARENA * a) {
+	size_t keep = round_up(a->used, sysconf(_SC_PAGESIZE));
+	if (keep < a->size) {
+		munmap(a->base + keep, a->size - keep);
+		a->size = keep;
+	}
+	a->sealed = 1;
+}
+
+void arena_destroy(ARENA * a) {
+	munmap(a->base, a->size);
+}
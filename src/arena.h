@@ -0,0 +1,41 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+/*
+ * One contiguous block of memory for everything a session keeps: filters,
+ * tables, buffers and queues are carved out of it in order while the
+ * session is built, and it all goes away at once with arena_destroy.
+ *
+ * The arena starts as a large reservation of address space, only the
+ * pages that get used become resident. arena_seal gives the unused tail
+ * back, after which the arena is exactly as big as the session and any
+ * further arena_alloc aborts. Include <stddef.h> first.
+ */
+
+/* Every allocation starts on a cache line, which is also enough for any
+ * SIMD vector we use */
+#define ARENA_ALIGN 64
+
+typedef struct ARENA {
+	char * base;
+	/* Bytes mapped and bytes handed out (including this header) */
+	size_t size;
+	size_t used;
+	/* How many allocations, and whether any more are allowed */
+	long allocs;
+	int sealed;
+} ARENA;
+
+ARENA * arena_create(size_t reserve);
+void * arena_alloc(ARENA * a, size_t bytes);
+void arena_seal(ARENA * a);
+void arena_destroy(ARENA * a);
@@ -0,0 +1,494 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+#include "arena.h"
+#include "bank.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/*
+ * ACCURACY
+ *
+ * The scalar and SSE2 paths perform exactly the same floating point
+ * operations in the same order as filter_touch_rotator, so their output
+ * is bit-for-bit identical to -kernel rotator. The AVX2 and AVX-512 paths
+ * use fused multiply-adds, which round once instead of twice. That makes
+ * each filter energy differ from the scalar path by a few ulps; in
+ * practice the difference stays below 1e-9 of the total filter energy,
+ * far too small to move a note across the 1/10-of-total threshold except
+ * for energies that were already sitting on it. Use -compare rotator to
+ * measure it on real input.
+ */
+
+/* Arena allocations are aligned for the widest vector */
+static double * bank_array(ARENA * arena, int stride, double value) {
+	double * a = (double*)arena_alloc(arena, stride * sizeof(double));
+	int i;
+	for (i = 0; i < stride; i++) {
+		a[i] = value;
+	}
+	return a;
+}
+
+/*
+ * Rounding error makes the phasors drift off the unit circle very slowly;
+ * pull them back once per call to bank_process.
+ */
+static void bank_renormalize(BANK * b) {
+	int i;
+	for (i = 0; i < b->n; i++) {
+		double mag = sqrt(b->psin[i]*b->psin[i] + b->pcos[i]*b->pcos[i]);
+		b->psin[i] /= mag;
+		b->pcos[i] /= mag;
+	}
+}
+
+static void bank_process_scalar(BANK * b, const double * x, int samples) {
+	int i, j;
+	for (i = 0; i < samples; i++) {
+		double delta = x[i];
+		for (j = 0; j < b->n; j++) {
+			double psin = b->psin[j];
+			double pcos = b->pcos[j];
+			double e;
+			b->xsin[j] = b->xsin[j] * b->rolloff[j] + delta * psin;
+			b->xcos[j] = b->xcos[j] * b->rolloff[j] + delta * pcos;
+			b->psin[j] = psin * b->dcos[j] + pcos * b->dsin[j];
+			b->pcos[j] = pcos * b->dcos[j] - psin * b->dsin[j];
+			e = b->xsin[j]*b->xsin[j] + b->xcos[j]*b->xcos[j];
+			if (e > b->max[j]) {
+				b->max[j] = e;
+			}
+			b->accumulator[j] += e;
+		}
+	}
+}
+
+/*
+ * Block-major versions of the bank_process_* kernels: each group of filters is run
+ * across the whole block with its state held in registers and written
+ * back once at the end. The arithmetic per filter is the same as the
+ * sample-major kernel for the same instruction set, so the results are
+ * identical.
+ *
+ * The phasor and projection updates form a dependency chain from one
+ * sample to the next, so the SIMD versions work on BLOCK_GROUPS vectors
+ * at once to give the CPU independent work while it waits.
+ */
+#define BLOCK_GROUPS 2
+
+static void bank_block_scalar(BANK * b, const double * x, int samples) {
+	int i, j;
+	for (j = 0; j < b->n; j++) {
+		double xsin = b->xsin[j], xcos = b->xcos[j];
+		double psin = b->psin[j], pcos = b->pcos[j];
+		double max = b->max[j], accumulator = b->accumulator[j];
+		double dsin = b->dsin[j], dcos = b->dcos[j], rolloff = b->rolloff[j];
+		for (i = 0; i < samples; i++) {
+			double delta = x[i];
+			double ps = psin;
+			double e;
+			xsin = xsin * rolloff + delta * ps;
+			xcos = xcos * rolloff + delta * pcos;
+			psin = ps * dcos + pcos * dsin;
+			pcos = pcos * dcos - ps * dsin;
+			e = xsin*xsin + xcos*xcos;
+			if (e > max) {
+				max = e;
+			}
+			accumulator += e;
+		}
+		b->xsin[j] = xsin;
+		b->xcos[j] = xcos;
+		b->psin[j] = psin;
+		b->pcos[j] = pcos;
+		b->max[j] = max;
+		b->accumulator[j] = accumulator;
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static void bank_process_sse2(BANK * b, const double * x, int samples) {
+	int i, j;
+	for (i = 0; i < samples; i++) {
+		__m128d delta = _mm_set1_pd(x[i]);
+		for (j = 0; j < b->stride; j += 2) {
+			__m128d r = _mm_load_pd(b->rolloff + j);
+			__m128d ds = _mm_load_pd(b->dsin + j);
+			__m128d dc = _mm_load_pd(b->dcos + j);
+			__m128d ps = _mm_load_pd(b->psin + j);
+			__m128d pc = _mm_load_pd(b->pcos + j);
+			__m128d xs = _mm_load_pd(b->xsin + j);
+			__m128d xc = _mm_load_pd(b->xcos + j);
+			__m128d e;
+			xs = _mm_add_pd(_mm_mul_pd(xs, r), _mm_mul_pd(delta, ps));
+			xc = _mm_add_pd(_mm_mul_pd(xc, r), _mm_mul_pd(delta, pc));
+			_mm_store_pd(b->psin + j, _mm_add_pd(_mm_mul_pd(ps, dc), _mm_mul_pd(pc, ds)));
+			_mm_store_pd(b->pcos + j, _mm_sub_pd(_mm_mul_pd(pc, dc), _mm_mul_pd(ps, ds)));
+			_mm_store_pd(b->xsin + j, xs);
+			_mm_store_pd(b->xcos + j, xc);
+			e = _mm_add_pd(_mm_mul_pd(xs, xs), _mm_mul_pd(xc, xc));
+			_mm_store_pd(b->max + j, _mm_max_pd(_mm_load_pd(b->max + j), e));
+			_mm_store_pd(b->accumulator + j, _mm_add_pd(_mm_load_pd(b->accumulator + j), e));
+		}
+	}
+}
+
+__attribute__((target("avx2,fma")))
+static void bank_process_avx2(BANK * b, const double * x, int samples) {
+	int i, j;
+	for (i = 0; i < samples; i++) {
+		__m256d delta = _mm256_set1_pd(x[i]);
+		for (j = 0; j < b->stride; j += 4) {
+			__m256d r = _mm256_load_pd(b->rolloff + j);
+			__m256d ds = _mm256_load_pd(b->dsin + j);
+			__m256d dc = _mm256_load_pd(b->dcos + j);
+			__m256d ps = _mm256_load_pd(b->psin + j);
+			__m256d pc = _mm256_load_pd(b->pcos + j);
+			__m256d xs = _mm256_load_pd(b->xsin + j);
+			__m256d xc = _mm256_load_pd(b->xcos + j);
+			__m256d e;
+			xs = _mm256_fmadd_pd(xs, r, _mm256_mul_pd(delta, ps));
+			xc = _mm256_fmadd_pd(xc, r, _mm256_mul_pd(delta, pc));
+			_mm256_store_pd(b->psin + j, _mm256_fmadd_pd(ps, dc, _mm256_mul_pd(pc, ds)));
+			_mm256_store_pd(b->pcos + j, _mm256_fmsub_pd(pc, dc, _mm256_mul_pd(ps, ds)));
+			_mm256_store_pd(b->xsin + j, xs);
+			_mm256_store_pd(b->xcos + j, xc);
+			e = _mm256_fmadd_pd(xs, xs, _mm256_mul_pd(xc, xc));
+			_mm256_store_pd(b->max + j, _mm256_max_pd(_mm256_load_pd(b->max + j), e));
+			_mm256_store_pd(b->accumulator + j, _mm256_add_pd(_mm256_load_pd(b->accumulator + j), e));
+		}
+	}
+}
+
+__attribute__((target("avx512f")))
+static void bank_process_avx512(BANK * b, const double * x, int samples) {
+	int i, j;
+	for (i = 0; i < samples; i++) {
+		__m512d delta = _mm512_set1_pd(x[i]);
+		for (j = 0; j < b->stride; j += 8) {
+			__m512d r = _mm512_load_pd(b->rolloff + j);
+			__m512d ds = _mm512_load_pd(b->dsin + j);
+			__m512d dc = _mm512_load_pd(b->dcos + j);
+			__m512d ps = _mm512_load_pd(b->psin + j);
+			__m512d pc = _mm512_load_pd(b->pcos + j);
+			__m512d xs = _mm512_load_pd(b->xsin + j);
+			__m512d xc = _mm512_load_pd(b->xcos + j);
+			__m512d e;
+			xs = _mm512_fmadd_pd(xs, r, _mm512_mul_pd(delta, ps));
+			xc = _mm512_fmadd_pd(xc, r, _mm512_mul_pd(delta, pc));
+			_mm512_store_pd(b->psin + j, _mm512_fmadd_pd(ps, dc, _mm512_mul_pd(pc, ds)));
+			_mm512_store_pd(b->pcos + j, _mm512_fmsub_pd(pc, dc, _mm512_mul_pd(ps, ds)));
+			_mm512_store_pd(b->xsin + j, xs);
+			_mm512_store_pd(b->xcos + j, xc);
+			e = _mm512_fmadd_pd(xs, xs, _mm512_mul_pd(xc, xc));
+			_mm512_store_pd(b->max + j, _mm512_max_pd(_mm512_load_pd(b->max + j), e));
+			_mm512_store_pd(b->accumulator + j, _mm512_add_pd(_mm512_load_pd(b->accumulator + j), e));
+		}
+	}
+}
+
+__attribute__((target("sse2")))
+static void bank_block_sse2(BANK * b, const double * x, int samples) {
+	int i, j, g;
+	for (j = 0; j < b->stride; j += 2 * BLOCK_GROUPS) {
+		__m128d r[BLOCK_GROUPS], ds[BLOCK_GROUPS], dc[BLOCK_GROUPS];
+		__m128d ps[BLOCK_GROUPS], pc[BLOCK_GROUPS], xs[BLOCK_GROUPS], xc[BLOCK_GROUPS];
+		__m128d mx[BLOCK_GROUPS], acc[BLOCK_GROUPS];
+		for (g = 0; g < BLOCK_GROUPS; g++) {
+			int k = j + g * 2;
+			r[g] = _mm_load_pd(b->rolloff + k);
+			ds[g] = _mm_load_pd(b->dsin + k);
+			dc[g] = _mm_load_pd(b->dcos + k);
+			ps[g] = _mm_load_pd(b->psin + k);
+			pc[g] = _mm_load_pd(b->pcos + k);
+			xs[g] = _mm_load_pd(b->xsin + k);
+			xc[g] = _mm_load_pd(b->xcos + k);
+			mx[g] = _mm_load_pd(b->max + k);
+			acc[g] = _mm_load_pd(b->accumulator + k);
+		}
+		for (i = 0; i < samples; i++) {
+			__m128d delta = _mm_set1_pd(x[i]);
+			for (g = 0; g < BLOCK_GROUPS; g++) {
+				__m128d p = ps[g];
+				__m128d e;
+				xs[g] = _mm_add_pd(_mm_mul_pd(xs[g], r[g]), _mm_mul_pd(delta, p));
+				xc[g] = _mm_add_pd(_mm_mul_pd(xc[g], r[g]), _mm_mul_pd(delta, pc[g]));
+				ps[g] = _mm_add_pd(_mm_mul_pd(p, dc[g]), _mm_mul_pd(pc[g], ds[g]));
+				pc[g] = _mm_sub_pd(_mm_mul_pd(pc[g], dc[g]), _mm_mul_pd(p, ds[g]));
+				e = _mm_add_pd(_mm_mul_pd(xs[g], xs[g]), _mm_mul_pd(xc[g], xc[g]));
+				mx[g] = _mm_max_pd(mx[g], e);
+				acc[g] = _mm_add_pd(acc[g], e);
+			}
+		}
+		for (g = 0; g < BLOCK_GROUPS; g++) {
+			int k = j + g * 2;
+			_mm_store_pd(b->psin + k, ps[g]);
+			_mm_store_pd(b->pcos + k, pc[g]);
+			_mm_store_pd(b->xsin + k, xs[g]);
+			_mm_store_pd(b->xcos + k, xc[g]);
+			_mm_store_pd(b->max + k, mx[g]);
+			_mm_store_pd(b->accumulator + k, acc[g]);
+		}
+	}
+}
+
+__attribute__((target("avx2,fma")))
+static void bank_block_avx2(BANK * b, const double * x, int samples) {
+	int i, j, g;
+	for (j = 0; j < b->stride; j += 4 * BLOCK_GROUPS) {
+		__m256d r[BLOCK_GROUPS], ds[BLOCK_GROUPS], dc[BLOCK_GROUPS];
+		__m256d ps[BLOCK_GROUPS], pc[BLOCK_GROUPS], xs[BLOCK_GROUPS], xc[BLOCK_GROUPS];
+		__m256d mx[BLOCK_GROUPS], acc[BLOCK_GROUPS];
+		for (g = 0; g < BLOCK_GROUPS; g++) {
+			int k = j + g * 4;
+			r[g] = _mm256_load_pd(b->rolloff + k);
+			ds[g] = _mm256_load_pd(b->dsin + k);
+			dc[g] = _mm256_load_pd(b->dcos + k);
+			ps[g] = _mm256_load_pd(b->psin + k);
+			pc[g] = _mm256_load_pd(b->pcos + k);
+			xs[g] = _mm256_load_pd(b->xsin + k);
+			xc[g] = _mm256_load_pd(b->xcos + k);
+			mx[g] = _mm256_load_pd(b->max + k);
+			acc[g] = _mm256_load_pd(b->accumulator + k);
+		}
+		for (i = 0; i < samples; i++) {
+			__m256d delta = _mm256_set1_pd(x[i]);
+			for (g = 0; g < BLOCK_GROUPS; g++) {
+				__m256d p = ps[g];
+				__m256d e;
+				xs[g] = _mm256_fmadd_pd(xs[g], r[g], _mm256_mul_pd(delta, p));
+				xc[g] = _mm256_fmadd_pd(xc[g], r[g], _mm256_mul_pd(delta, pc[g]));
+				ps[g] = _mm256_fmadd_pd(p, dc[g], _mm256_mul_pd(pc[g], ds[g]));
+				pc[g] = _mm256_fmsub_pd(pc[g], dc[g], _mm256_mul_pd(p, ds[g]));
+				e = _mm256_fmadd_pd(xs[g], xs[g], _mm256_mul_pd(xc[g], xc[g]));
+				mx[g] = _mm256_max_pd(mx[g], e);
+				acc[g] = _mm256_add_pd(acc[g], e);
+			}
+		}
+		for (g = 0; g < BLOCK_GROUPS; g++) {
+			int k = j + g * 4;
+			_mm256_store_pd(b->psin + k, ps[g]);
+			_mm256_store_pd(b->pcos + k, pc[g]);
+			_mm256_store_pd(b->xsin + k, xs[g]);
+			_mm256_store_pd(b->xcos + k, xc[g]);
+			_mm256_store_pd(b->max + k, mx[g]);
+			_mm256_store_pd(b->accumulator + k, acc[g]);
+		}
+	}
+}
+
+__attribute__((target("avx512f")))
+static void bank_block_avx512(BANK * b, const double * x, int samples) {
+	int i, j, g;
+	for (j = 0; j < b->stride; j += 8 * BLOCK_GROUPS) {
+		__m512d r[BLOCK_GROUPS], ds[BLOCK_GROUPS], dc[BLOCK_GROUPS];
+		__m512d ps[BLOCK_GROUPS], pc[BLOCK_GROUPS], xs[BLOCK_GROUPS], xc[BLOCK_GROUPS];
+		__m512d mx[BLOCK_GROUPS], acc[BLOCK_GROUPS];
+		for (g = 0; g < BLOCK_GROUPS; g++) {
+			int k = j + g * 8;
+			r[g] = _mm512_load_pd(b->rolloff + k);
+			ds[g] = _mm512_load_pd(b->dsin + k);
+			dc[g] = _mm512_load_pd(b->dcos + k);
+			ps[g] = _mm512_load_pd(b->psin + k);
+			pc[g] = _mm512_load_pd(b->pcos + k);
+			xs[g] = _mm512_load_pd(b->xsin + k);
+			xc[g] = _mm512_load_pd(b->xcos + k);
+			mx[g] = _mm512_load_pd(b->max + k);
+			acc[g] = _mm512_load_pd(b->accumulator + k);
+		}
+		for (i = 0; i < samples; i++) {
+			__m512d delta = _mm512_set1_pd(x[i]);
+			for (g = 0; g < BLOCK_GROUPS; g++) {
+				__m512d p = ps[g];
+				__m512d e;
+				xs[g] = _mm512_fmadd_pd(xs[g], r[g], _mm512_mul_pd(delta, p));
+				xc[g] = _mm512_fmadd_pd(xc[g], r[g], _mm512_mul_pd(delta, pc[g]));
+				ps[g] = _mm512_fmadd_pd(p, dc[g], _mm512_mul_pd(pc[g], ds[g]));
+				pc[g] = _mm512_fmsub_pd(pc[g], dc[g], _mm512_mul_pd(p, ds[g]));
+				e = _mm512_fmadd_pd(xs[g], xs[g], _mm512_mul_pd(xc[g], xc[g]));
+				mx[g] = _mm512_max_pd(mx[g], e);
+				acc[g] = _mm512_add_pd(acc[g], e);
+			}
+		}
+		for (g = 0; g < BLOCK_GROUPS; g++) {
+			int k = j + g * 8;
+			_mm512_store_pd(b->psin + k, ps[g]);
+			_mm512_store_pd(b->pcos + k, pc[g]);
+			_mm512_store_pd(b->xsin + k, xs[g]);
+			_mm512_store_pd(b->xcos + k, xc[g]);
+			_mm512_store_pd(b->max + k, mx[g]);
+			_mm512_store_pd(b->accumulator + k, acc[g]);
+		}
+	}
+}
+
+#endif
+
+/*
+ * Pick the kernel for a named instruction set. Returns -1 if this build or
+ * this CPU can't run it. "auto" picks the widest one available.
+ */
+int bank_select_isa(BANK * b, char * isa) {
+	int automatic = !strcmp(isa, "auto");
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if ((automatic || !strcmp(isa, "avx512")) && __builtin_cpu_supports("avx512f")) {
+		b->isa = "avx512";
+		b->process = bank_process_avx512;
+		b->block = bank_block_avx512;
+		return 0;
+	}
+	if ((automatic || !strcmp(isa, "avx2")) && __builtin_cpu_supports("avx2")
+			&& __builtin_cpu_supports("fma")) {
+		b->isa = "avx2";
+		b->process = bank_process_avx2;
+		b->block = bank_block_avx2;
+		return 0;
+	}
+	if ((automatic || !strcmp(isa, "sse2")) && __builtin_cpu_supports("sse2")) {
+		b->isa = "sse2";
+		b->process = bank_process_sse2;
+		b->block = bank_block_sse2;
+		return 0;
+	}
+#endif
+	if (automatic || !strcmp(isa, "scalar")) {
+		b->isa = "scalar";
+		b->process = bank_process_scalar;
+		b->block = bank_block_scalar;
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * Allocate a bank of |n| filters. They start out at 0Hz with no
+ * rolloff; fill them in with bank_set_filter.
+ */
+BANK * bank_create(ARENA * arena, int n) {
+	BANK * b;
+	b = (BANK*)arena_alloc(arena, sizeof(*b));
+	b->n = n;
+	b->stride = (n + BANK_PAD - 1) / BANK_PAD * BANK_PAD;
+
+	b->xsin = bank_array(arena, b->stride, 0);
+	b->xcos = bank_array(arena, b->stride, 0);
+	b->psin = bank_array(arena, b->stride, 0);
+	b->pcos = bank_array(arena, b->stride, 1);
+	b->accumulator = bank_array(arena, b->stride, 0);
+	b->max = bank_array(arena, b->stride, 0);
+	b->dsin = bank_array(arena, b->stride, 0);
+	b->dcos = bank_array(arena, b->stride, 1);
+	b->rolloff = bank_array(arena, b->stride, 0);
+	b->normalizer = bank_array(arena, b->stride, 0);
+	bank_reset(b);
+
+	bank_select_isa(b, "auto");
+	return b;
+}
+
+/*
+ * Set up filter |i|. |dsin| and |dcos| are the sine and cosine of the
+ * phase step per sample.
+ */
+void bank_set_filter(BANK * b, int i, double dsin, double dcos, double rolloff, double normalizer) {
+	b->dsin[i] = dsin;
+	b->dcos[i] = dcos;
+	b->rolloff[i] = rolloff;
+	b->normalizer[i] = normalizer;
+}
+
+/*
+ * Feed |samples| samples to every filter, one sample at a time.
+ */
+void bank_process(BANK * b, const double * x, int samples) {
+	b->process(b, x, samples);
+	bank_renormalize(b);
+}
+
+/*
+ * Feed a contiguous block of |samples| samples to every filter, one group
+ * of filters at a time. Produces exactly the same state as bank_process
+ * but keeps each filter's state in registers for the whole block.
+ */
+void bank_process_block(BANK * b, const double * x, int samples) {
+	b->block(b, x, samples);
+	bank_renormalize(b);
+}
+
+/*
+ * Same as filter_energy_max for every filter: fill in |energy| with the
+ * normalized peak energy since the last call and reset the peak.
+ */
+void bank_energy_max(BANK * b, double * energy) {
+	int i;
+	for (i = 0; i < b->n; i++) {
+		energy[i] = b->max[i] * b->normalizer[i];
+		b->max[i] = 0;
+	}
+}
+
+/*
+ * Same as feeding |samples| zeros to every filter, in closed form: the
+ * projections shrink by rolloff^samples and the phasors turn by samples
+ * steps. The energy only falls during silence, so the peak is the energy
+ * after the first sample and the accumulator gets a geometric series.
+ */
+void bank_decay(BANK * b, int samples) {
+	int i;
+	if (samples <= 0) {
+		return;
+	}
+	for (i = 0; i < b->n; i++) {
+		double r2 = b->rolloff[i] * b->rolloff[i];
+		double rn = pow(b->rolloff[i], samples);
+		double e = b->xsin[i]*b->xsin[i] + b->xcos[i]*b->xcos[i];
+		double w = atan2(b->dsin[i], b->dcos[i]) * samples;
+		double s = sin(w), c = cos(w);
+		double psin = b->psin[i], pcos = b->pcos[i];
+		if (e * r2 > b->max[i]) {
+			b->max[i] = e * r2;
+		}
+		b->accumulator[i] += e * r2 * (1 - rn*rn) / (1 - r2);
+		b->xsin[i] *= rn;
+		b->xcos[i] *= rn;
+		b->psin[i] = psin * c + pcos * s;
+		b->pcos[i] = pcos * c - psin * s;
+	}
+}
+
+/*
+ * Forget all input, as if the bank had just been created. Padding filters
+ * get a zero phasor, so they never pick up any input at all.
+ */
+void bank_reset(BANK * b) {
+	int i;
+	for (i = 0; i < b->stride; i++) {
+		b->xsin[i] = 0;
+		b->xcos[i] = 0;
+		b->psin[i] = 0;
+		b->pcos[i] = i < b->n;
+		b->accumulator[i] = 0;
+		b->max[i] = 0;
+	}
+}
+
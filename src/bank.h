@@ -0,0 +1,65 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+/*
+ * A structure-of-arrays filter bank. This is the same rotator filter as
+ * filter_touch_rotator in analyzer.c, but every field lives in its own
+ * cache-aligned array so the bank can be updated several filters at a
+ * time with SIMD instructions.
+ *
+ * The arrays are padded to a multiple of BANK_PAD filters. Padding
+ * filters have a zero phasor, so they have no input response and their
+ * energy stays zero.
+ *
+ * A bank lives in an ARENA and goes away with it. Include arena.h first.
+ */
+
+/* Widest SIMD vector we support, in doubles (AVX-512) */
+#define BANK_WIDTH 8
+/* The block kernels handle two of those vectors at a time */
+#define BANK_PAD (2 * BANK_WIDTH)
+
+typedef struct BANK {
+	/* Number of real filters and padded array length */
+	int n;
+	int stride;
+
+	/* Hot state, touched on every sample */
+	double * xsin;
+	double * xcos;
+	double * psin;
+	double * pcos;
+	double * accumulator;
+	double * max;
+
+	/* Read-only parameters, also touched on every sample */
+	double * dsin;
+	double * dcos;
+	double * rolloff;
+
+	/* Cold, only used when extracting energies */
+	double * normalizer;
+
+	/* Which instruction set process uses */
+	char * isa;
+	void (*process)(struct BANK * b, const double * x, int samples);
+	void (*block)(struct BANK * b, const double * x, int samples);
+} BANK;
+
+BANK * bank_create(ARENA * arena, int n);
+void bank_set_filter(BANK * b, int i, double dsin, double dcos, double rolloff, double normalizer);
+int bank_select_isa(BANK * b, char * isa);
+void bank_process(BANK * b, const double * x, int samples);
+void bank_process_block(BANK * b, const double * x, int samples);
+void bank_energy_max(BANK * b, double * energy);
+void bank_reset(BANK * b);
+void bank_decay(BANK * b, int samples);
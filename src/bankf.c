@@ -0,0 +1,188 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "arena.h"
+#include "bankf.h"
+
+/*
+ * ACCURACY
+ *
+ * Each update rounds to 24 bits instead of 53. For the low notes the
+ * rolloff is within 1e-4 of 1, so rounding it to a float would move the
+ * half-life (and the steady state energy) by a tenth of a percent; we keep
+ * 1 - rolloff instead and decay with x - x*(1-rolloff), which costs
+ * nothing extra with fused multiply-adds. The same goes for the rotation:
+ * cos(step) is close to 1 too, and rounding p*cos(step) on every sample
+ * shrinks the phasor by about 1e-4 per block. So we rotate with
+ * p + p*(cos(step)-1) + q*sin(step), where the rounding is relative to
+ * the (small) change instead of to p.
+ *
+ * That leaves energies within about 1e-5 of -kernel block. The phasors are rebuilt
+ * from a phase kept in double after every block, so float rounding in the
+ * rotation never adds up to a frequency or amplitude error. Note decisions
+ * only change for energies that were already within that of the 1/10 of
+ * total threshold. Use -kernel float -validate to measure it on real input.
+ */
+
+typedef float FV __attribute__((vector_size(BANKF_WIDTH * sizeof(float))));
+typedef int IV __attribute__((vector_size(BANKF_WIDTH * sizeof(int))));
+
+static float * bankf_array(ARENA * arena, int stride, float value) {
+	float * a = (float*)arena_alloc(arena, stride * sizeof(float));
+	int i;
+	for (i = 0; i < stride; i++) {
+		a[i] = value;
+	}
+	return a;
+}
+
+BANKF * bankf_create(ARENA * arena, int n) {
+	BANKF * b;
+	b = (BANKF*)arena_alloc(arena, sizeof(*b));
+	b->n = n;
+	b->stride = (n + BANKF_PAD - 1) / BANKF_PAD * BANKF_PAD;
+
+	b->xsin = bankf_array(arena, b->stride, 0);
+	b->xcos = bankf_array(arena, b->stride, 0);
+	b->psin = bankf_array(arena, b->stride, 0);
+	b->pcos = bankf_array(arena, b->stride, 1);
+	b->accumulator = bankf_array(arena, b->stride, 0);
+	b->max = bankf_array(arena, b->stride, 0);
+	b->dsin = bankf_array(arena, b->stride, 0);
+	b->dcos1 = bankf_array(arena, b->stride, 0);
+	b->decay = bankf_array(arena, b->stride, 1);
+	b->normalizer = (double*)arena_alloc(arena, b->stride * sizeof(double));
+	b->step = (double*)arena_alloc(arena, b->stride * sizeof(double));
+	b->rolloff_exact = (double*)arena_alloc(arena, b->stride * sizeof(double));
+	b->phase = (double*)arena_alloc(arena, b->stride * sizeof(double));
+	return b;
+}
+
+void bankf_set_filter(BANKF * b, int i, double dsin, double dcos, double rolloff, double normalizer) {
+	b->dsin[i] = dsin;
+	b->dcos1[i] = dcos - 1;
+	b->decay[i] = 1 - rolloff;
+	b->normalizer[i] = normalizer;
+	b->step[i] = atan2(dsin, dcos);
+	b->rolloff_exact[i] = rolloff;
+}
+
+/*
+ * Move every phase on by |samples| steps and reset the phasors to match.
+ * This takes the place of bank_renormalize.
+ */
+static void bankf_resync(BANKF * b, int samples) {
+	int i;
+	for (i = 0; i < b->n; i++) {
+		b->phase[i] = fmod(b->phase[i] + b->step[i] * samples, 2 * M_PI);
+		b->psin[i] = sin(b->phase[i]);
+		b->pcos[i] = cos(b->phase[i]);
+	}
+}
+
+/*
+ * Same recurrence as bank_block_*: BANKF_PAD filters at a time, held in
+ * registers for the whole block. Compiled for several instruction sets,
+ * picked at load time.
+ */
+#if defined(__x86_64__)
+__attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+void bankf_process_block(BANKF * b, const float * x, int samples) {
+	int i, j, g;
+	for (j = 0; j < b->stride; j += BANKF_PAD) {
+		FV xs[2], xc[2], ps[2], pc[2], ds[2], dc1[2], q[2], mx[2], acc[2];
+		for (g = 0; g < 2; g++) {
+			int k = j + g * BANKF_WIDTH;
+			xs[g] = *(FV*)(b->xsin + k);
+			xc[g] = *(FV*)(b->xcos + k);
+			ps[g] = *(FV*)(b->psin + k);
+			pc[g] = *(FV*)(b->pcos + k);
+			ds[g] = *(FV*)(b->dsin + k);
+			dc1[g] = *(FV*)(b->dcos1 + k);
+			q[g] = *(FV*)(b->decay + k);
+			mx[g] = *(FV*)(b->max + k);
+			acc[g] = *(FV*)(b->accumulator + k);
+		}
+		for (i = 0; i < samples; i++) {
+			float delta = x[i];
+			for (g = 0; g < 2; g++) {
+				FV s = ps[g];
+				FV e;
+				IV bigger;
+				xs[g] = xs[g] - xs[g] * q[g] + delta * s;
+				xc[g] = xc[g] - xc[g] * q[g] + delta * pc[g];
+				ps[g] = s + (s * dc1[g] + pc[g] * ds[g]);
+				pc[g] = pc[g] + (pc[g] * dc1[g] - s * ds[g]);
+				e = xs[g] * xs[g] + xc[g] * xc[g];
+				bigger = e > mx[g];
+				mx[g] = (FV)(((IV)e & bigger) | ((IV)mx[g] & ~bigger));
+				acc[g] += e;
+			}
+		}
+		for (g = 0; g < 2; g++) {
+			int k = j + g * BANKF_WIDTH;
+			*(FV*)(b->xsin + k) = xs[g];
+			*(FV*)(b->xcos + k) = xc[g];
+			*(FV*)(b->psin + k) = ps[g];
+			*(FV*)(b->pcos + k) = pc[g];
+			*(FV*)(b->max + k) = mx[g];
+			*(FV*)(b->accumulator + k) = acc[g];
+		}
+	}
+	bankf_resync(b, samples);
+}
+
+void bankf_energy_max(BANKF * b, double * energy) {
+	int i;
+	for (i = 0; i < b->n; i++) {
+		energy[i] = b->max[i] * b->normalizer[i];
+		b->max[i] = 0;
+	}
+}
+
+void bankf_reset(BANKF * b) {
+	int i;
+	for (i = 0; i < b->stride; i++) {
+		b->xsin[i] = 0;
+		b->xcos[i] = 0;
+		b->psin[i] = 0;
+		b->pcos[i] = 1;
+		b->accumulator[i] = 0;
+		b->max[i] = 0;
+		b->phase[i] = 0;
+	}
+}
+
+/* Same as bank_decay, worked out in double */
+void bankf_decay(BANKF * b, int samples) {
+	int i;
+	if (samples <= 0) {
+		return;
+	}
+	for (i = 0; i < b->n; i++) {
+		double r = b->rolloff_exact[i];
+		double r2 = r * r;
+		double rn = pow(r, samples);
+		double e = (double)b->xsin[i]*b->xsin[i] + (double)b->xcos[i]*b->xcos[i];
+		if (e * r2 > b->max[i]) {
+			b->max[i] = e * r2;
+		}
+		b->accumulator[i] += e * r2 * (1 - rn*rn) / (1 - r2);
+		b->xsin[i] *= rn;
+		b->xcos[i] *= rn;
+	}
+	bankf_resync(b, samples);
+}
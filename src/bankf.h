@@ -0,0 +1,57 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+/*
+ * Single precision version of the block-major filter bank in bank.c. The
+ * state is float, which halves the footprint and doubles the number of
+ * filters per vector; the normalizer and the energies handed back stay
+ * double. See bankf.c for how far it drifts from the double bank.
+ * Include arena.h first.
+ */
+
+/* Filters per vector (a full AVX-512 register), and per group of
+ * vectors run together */
+#define BANKF_WIDTH 16
+#define BANKF_PAD (2 * BANKF_WIDTH)
+
+typedef struct {
+	int n;
+	int stride;
+
+	float * xsin;
+	float * xcos;
+	float * psin;
+	float * pcos;
+	float * accumulator;
+	float * max;
+
+	/* sin(step) and cos(step) - 1 */
+	float * dsin;
+	float * dcos1;
+	/* 1 - rolloff. The rolloff itself is too close to 1 for a float to
+	 * hold it accurately. */
+	float * decay;
+
+	double * normalizer;
+	/* Exact phase step per sample, rolloff and the phase each phasor
+	 * should be at, for resyncing and decaying */
+	double * step;
+	double * rolloff_exact;
+	double * phase;
+} BANKF;
+
+BANKF * bankf_create(ARENA * arena, int n);
+void bankf_set_filter(BANKF * b, int i, double dsin, double dcos, double rolloff, double normalizer);
+void bankf_process_block(BANKF * b, const float * x, int samples);
+void bankf_energy_max(BANKF * b, double * energy);
+void bankf_reset(BANKF * b);
+void bankf_decay(BANKF * b, int samples);
@@ -0,0 +1,57 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+#include <stdint.h>
+
+/*
+ * Fixed-point version of the filter bank, for machines where double
+ * precision is slow or missing. Input is 16 bit, the phase is a 32 bit
+ * accumulator indexing a Q15 sine table, the decay is a Q31 multiply and
+ * shift, and the energies are 64 bit integers. Only turning the final
+ * peak energies into doubles for filter_guess_notes needs floating point.
+ * Include arena.h first.
+ */
+
+/* Fractional bits kept in the projections */
+#define BANKQ_FRAC 15
+
+typedef struct {
+	int n;
+
+	/* Projections, with BANKQ_FRAC fractional bits */
+	int64_t * xsin;
+	int64_t * xcos;
+	/* Phase as a fraction of a turn, and the step per sample */
+	uint32_t * phase;
+	uint32_t * step;
+	/* 1 - rolloff in Q31 */
+	int32_t * decay;
+
+	/* Peak energy and summed energy (>> BANKQ_ACC_SHIFT) since the last
+	 * bankq_energy_max */
+	int64_t * max;
+	int64_t * accumulator;
+
+	/* Fractional bits dropped before squaring (see bankq.c), and what
+	 * turns the integer energy into the same units as the double bank,
+	 * normalizer included, so MINIMUM_ENERGY needs no change */
+	int * shift;
+	double * scale;
+	double * rolloff;
+} BANKQ;
+
+BANKQ * bankq_create(ARENA * arena, int n);
+void bankq_set_filter(BANKQ * b, int i, double freq, double sample_freq, double rolloff, double normalizer);
+void bankq_process_block(BANKQ * b, const int16_t * x, int samples);
+void bankq_energy_max(BANKQ * b, double * energy);
+void bankq_reset(BANKQ * b);
+void bankq_decay(BANKQ * b, int samples);
@@ -21,6 +21,8 @@ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
 #include <assert.h>
 
 #include "notes.h"
+#include "arena.h"
+#include "planner.h"
 
 /* What is the input sample rate */
 #define SAMPLE_RATE 44100
@@ -40,6 +42,23 @@ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
 
 #define MAX_SAMPLES 100
 
+/*
+ * do_fft zeroes everything above CHUNK_SIZE/2, so no bin past this can
+ * ever be the loudest
+ */
+#define WINNER_BINS (CHUNK_SIZE/2 + 1)
+/* Enough levels for WINNER_BINS, which must fit in an unsigned short */
+#define WINNER_LEVELS 16
+
+/*
+ * A sparse table for finding the loudest bin of a spectrum in any range:
+ * level[k][i] is the bin pickwinner would pick from [i, i + 2^k). Level 0
+ * would be i itself and isn't stored.
+ */
+typedef struct {
+	unsigned short * level[WINNER_LEVELS];
+} WINNERS;
+
 /*
  * Utility struct that holds the state of the world while we process
  * things.
@@ -57,10 +76,25 @@ typedef struct {
 	/* Input file descriptor */
 	int fd;
 
+	/* The last MAX_SAMPLES chunks' loudest bins and their logs, as ring
+	 * buffers: slot |head| holds the oldest chunk (see history_slot) */
+	int head;
 	int history[MAX_SAMPLES];
-	double * e_history[MAX_SAMPLES];
+	double log_history[MAX_SAMPLES];
+	/* Their spectra, in a ring of one row fewer (see e_history_slot),
+	 * and a WINNERS for each */
+	int e_head;
+	double * e_history[MAX_SAMPLES - 1];
+	WINNERS e_winners[MAX_SAMPLES - 1];
 } STATE;
 
+/* log() of every bin number, so the matcher never calls log() itself */
+double bin_log[CHUNK_SIZE];
+/* floor(log2(n)) for every range length a WINNERS is asked about */
+unsigned char span_log2[WINNER_BINS + 1];
+/* How many levels each WINNERS has */
+int winner_levels;
+
 
 int pickwinner(double * energies, int low_cutoff, int high_cutoff) {
 	double max = 0;
@@ -75,19 +109,76 @@ int pickwinner(double * energies, int low_cutoff, int high_cutoff) {
 	return maxi;
 }
 
+/*
+ * pickwinner only takes a bin louder than everything before it and louder
+ * than 0, so this is what it compares. (The energies are never negative,
+ * but a NaN never wins either.)
+ */
+static inline double winner_key(double e) {
+	return e > 0 ? e : 0;
+}
+
+/* Of two bins with a < b, the one pickwinner would pick */
+static inline int better_winner(const double * energies, int a, int b) {
+	return winner_key(energies[b]) > winner_key(energies[a]) ? b : a;
+}
+
+/* Fill in |w| for a new spectrum: O(WINNER_BINS log WINNER_BINS) */
+void build_winners(WINNERS * w, const double * energies) {
+	int k, i;
+	for (i = 0; i + 1 < WINNER_BINS; i++) {
+		w->level[1][i] = better_winner(energies, i, i + 1);
+	}
+	for (k = 2; k < winner_levels; k++) {
+		int half = 1 << (k - 1);
+		for (i = 0; i + (1 << k) <= WINNER_BINS; i++) {
+			w->level[k][i] = better_winner(energies,
+				w->level[k-1][i], w->level[k-1][i + half]);
+		}
+	}
+}
+
+/*
+ * The same as pickwinner(energies, low_cutoff, high_cutoff), but looked up
+ * in |w| in constant time: the range is covered by two (overlapping)
+ * power of two ranges and the better of their winners is the winner.
+ */
+int range_winner(const WINNERS * w, const double * energies, int low_cutoff, int high_cutoff) {
+	int k, a, b;
+	if (low_cutoff < 0) {
+		low_cutoff = 0;
+	}
+	if (high_cutoff > WINNER_BINS) {
+		high_cutoff = WINNER_BINS;
+	}
+	if (low_cutoff >= high_cutoff) {
+		return 0;
+	}
+	k = span_log2[high_cutoff - low_cutoff];
+	if (k == 0) {
+		a = low_cutoff;
+	} else {
+		a = w->level[k][low_cutoff];
+		b = w->level[k][high_cutoff - (1 << k)];
+		a = better_winner(energies, a, b);
+	}
+	return winner_key(energies[a]) > 0 ? a : 0;
+}
+
 
 
 /*
- * Allocate arrays for fftw and setup a fft plan 
+ * Allocate arrays for fftw (in |arena|, which is aligned well enough) and
+ * setup a fft plan 
  */
-void setup_fftw(STATE * s) {
-	s->fftw_in= (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * CHUNK_SIZE);
-	s->fftw_out= (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * CHUNK_SIZE);
+void setup_fftw(STATE * s, ARENA * arena, unsigned flags) {
+	s->fftw_in= (fftw_complex*)arena_alloc(arena, sizeof(fftw_complex) * CHUNK_SIZE);
+	s->fftw_out= (fftw_complex*)arena_alloc(arena, sizeof(fftw_complex) * CHUNK_SIZE);
 
 	s->fftwplan = fftw_plan_dft_1d(CHUNK_SIZE,
 			s->fftw_in,
 			s->fftw_out,
-			FFTW_FORWARD,FFTW_MEASURE);
+			FFTW_FORWARD,flags);
 }
 
 
@@ -118,10 +209,8 @@ int get_data_chunk(STATE * s) {
 	return 0;
 }
 
-/*
- * This does the FFT, computing s->energy froms->tmpdata
- */
-int do_fft(STATE * s, double * output) {
+/* Compute the spectrum of the chunk in |s| into |output| and index it in |w| */
+int do_fft(STATE * s, double * output, WINNERS * w) {
 
 	int i;
 	double total_energy;
@@ -153,38 +242,96 @@ int do_fft(STATE * s, double * output) {
 		}
 	}
 
+	build_winners(w, output);
 	return 0;
 }
 
-double * add_e_history(double ** e_history, int n) {
-	int i;
-	e_history[n-1] = e_history[0];
+/* Where chunk |k| (0 is the oldest) lives in the ring buffers */
+static inline int history_slot(STATE * s, int k) {
+	return (s->head + k) % MAX_SAMPLES;
+}
 
-	for (i = 0; i < n-1; i++) {
-		e_history[i] = e_history[i+1];
+/*
+ * Where the spectrum of chunk |k| lives. The matcher has always seen the
+ * newest spectrum at both MAX_SAMPLES-2 and MAX_SAMPLES-1 and the older
+ * ones a chunk early, so this keeps doing just that.
+ */
+static inline int e_history_slot(STATE * s, int k) {
+	if (k > MAX_SAMPLES - 2) {
+		k = MAX_SAMPLES - 2;
 	}
-	return e_history[n-1];
+	return (s->e_head + k) % (MAX_SAMPLES - 1);
 }
-void setup_e_history(double ** e_history, int n) {
-	int i;
-	for (i = 0; i < n; i++) {
-		e_history[i] = calloc(CHUNK_SIZE,  sizeof(double));
-	}
+
+/*
+ * The slot for the next chunk's spectrum and WINNERS: the oldest one,
+ * which it replaces
+ */
+int add_e_history(STATE * s) {
+	int slot = s->e_head;
+	s->e_head = (s->e_head + 1) % (MAX_SAMPLES - 1);
+	return slot;
 }
 
-void add_history(int * history, int n, int new) {
-	int i;
+/* All the rows and tables come out of two blocks of |arena| */
+void setup_e_history(ARENA * arena, STATE * s) {
+	int n = MAX_SAMPLES - 1;
+	int i, k;
+	double * rows = (double*)arena_alloc(arena, sizeof(double) * CHUNK_SIZE * n);
+	unsigned short * tables;
 
-	for (i = 0; i < n-1; i++) {
-		history[i] = history[i+1];
+	winner_levels = 1;
+	while ((1 << winner_levels) <= WINNER_BINS) {
+		winner_levels++;
+	}
+	span_log2[1] = 0;
+	for (i = 2; i <= WINNER_BINS; i++) {
+		span_log2[i] = span_log2[i/2] + 1;
 	}
 
-	history[n-1] = new;
+	tables = (unsigned short*)arena_alloc(arena,
+		sizeof(*tables) * WINNER_BINS * (winner_levels - 1) * n);
+	for (i = 0; i < n; i++) {
+		s->e_history[i] = rows + (size_t)CHUNK_SIZE * i;
+		for (k = 1; k < winner_levels; k++) {
+			s->e_winners[i].level[k] = tables;
+			tables += WINNER_BINS;
+		}
+	}
+}
+
+/* Finish the chunk add_e_history started: |new| is its loudest bin */
+void add_history(STATE * s, int new) {
+	s->history[s->head] = new;
+	s->log_history[s->head] = bin_log[new];
+	s->head = (s->head + 1) % MAX_SAMPLES;
 }
 
 
 double music[] = {N_E5, N_D5s, N_E5, N_D5s, N_E5, N_B4, N_D5, N_C5, N_A4};//,  N_C4, N_E4, N_A4, N_B4};
 
+/*
+ * log() of every note of the music (plus a spare, since calc_score2 looks
+ * one past the end and then ignores it), and the sum of the first half,
+ * added up in the same order calc_score2 and calc_range used to.
+ */
+double music_log[LEN(music) + 1];
+double music_log_half;
+
+void setup_logs() {
+	int i;
+	for (i = 0; i < CHUNK_SIZE; i++) {
+		bin_log[i] = log(i);
+	}
+	for (i = 0; i < LEN(music); i++) {
+		music_log[i] = log(music[i]);
+	}
+	music_log_half = 0;
+	for (i = 0; i < LEN(music)/2; i++) {
+		music_log_half += music_log[i];
+	}
+}
+
 double energy_in_f(double * history, double freq_shift, int i) {
 	int fidx;
 	double m;
@@ -261,28 +408,24 @@ void calc_score3(double ** history, int history_n, double * score_out, double *s
 }
 */
 //double music[] = {N_E5, N_E5, N_E5, N_E5, N_E5};
-void calc_score2(int * history, int history_n, double * score_out, double * time_shift_out, double * freq_shift_out) {
+/*
+ * Score how well the bins whose logs are in |log_history| fit the music.
+ * All logs come from the tables in setup_logs, and every sum is added up
+ * in the same order as when this called log() itself, so the results are
+ * bit for bit the same.
+ */
+void calc_score2(const double * log_history, int history_n, double * score_out, double * time_shift_out, double * freq_shift_out) {
 	int t_max = LEN(music);
 	double time_shift = (double)(history_n) / (double)t_max;
 	double freq_shift = 0;
 
-	double i_h=0, i_hh=0,i_m=0,i_mm=0,i_hm=0;
+	double i_h=0,i_m=music_log_half;
 	double score = 0;
 	int i;
 	int x;
 
-	for (i = 0; i < t_max/2; i++) {
-		double m;
-		m = log(music[i]);
-		i_m+=m;
-		i_mm+=m*m;
-	}
-
 	for (i = 0; i < history_n/2; i++) {
-		double h;
-		h = log(history[i]);
-		i_h+=h;
-		i_hh+=h*h;
+		i_h+=log_history[i];
 	}
 
 	freq_shift = (i_m/(double)(t_max/2) - i_h/(double)(history_n/2));
@@ -292,10 +435,10 @@ void calc_score2(int * history, int history_n, double * score_out, double * time
 		double distl, disth;
 		il = (double)x / time_shift;
 		ih = (double)(x+1)/time_shift;
-		distl = (freq_shift + log(history[x]) - log(music[il]));
+		distl = (freq_shift + log_history[x] - music_log[il]);
 		distl*=distl;
 
-		disth = freq_shift + log(history[x]) - log(music[ih]);
+		disth = freq_shift + log_history[x] - music_log[ih];
 		disth*=disth;
 
 		if (disth > distl || ih >= t_max) {
@@ -316,23 +459,16 @@ void calc_score2(int * history, int history_n, double * score_out, double * time
 	//printf("FS: %f %f %f %f %f %i %i %f\n", freq_shift, i_m, i_h, i_m/(double)(history_n), i_h/(double)t_max, history_n, t_max, score);
 }
 
-void calc_range(int * history, int history_n, int *low_out, int*high_out) {
-	double i_m = 0, i_h = 0;
+/* Which bins to look at, going by the last |history_n| chunks' loudest */
+void calc_range(STATE * s, int history_n, int *low_out, int*high_out) {
+	double i_m = music_log_half, i_h = 0;
 	double freq_shift;
 	int t_max = LEN(music);
 
 	int i;
 
-	for (i = 0; i < t_max/2; i++) {
-		double m;
-		m = log(music[i]);
-		i_m+=m;
-	}
-
 	for (i = 0; i < history_n/2; i++) {
-		double h;
-		h = log(history[i]);
-		i_h+=h;
+		i_h+=s->log_history[history_slot(s, MAX_SAMPLES - history_n + i)];
 	}
 
 	freq_shift = (i_m/(double)(t_max/2) - i_h/(double)(history_n/2));
@@ -346,12 +482,15 @@ void calc_range(int * history, int history_n, int *low_out, int*high_out) {
 void do_it(STATE* s, int blen, double *score_out, double *time_shift_out, double * freq_shift_out, int * lr, int * hr) {
 
 	int low, high;
-	int new_history[MAX_SAMPLES];
+	double new_history[MAX_SAMPLES];
 	int i;
-	calc_range(s->history + MAX_SAMPLES - blen, blen, &low, &high);
+	calc_range(s, blen, &low, &high);
 
+	/* Only the logs of the new winners are needed */
 	for (i = 0; i < blen; i++) {
-		new_history[i] = pickwinner(s->e_history[MAX_SAMPLES-blen+i], low, high);
+		int slot = e_history_slot(s, MAX_SAMPLES - blen + i);
+		new_history[i] = bin_log[range_winner(s->e_winners + slot,
+			s->e_history[slot], low, high)];
 	}
 
 	calc_score2(new_history, blen, score_out, time_shift_out, freq_shift_out);
@@ -394,7 +533,7 @@ int check_history(STATE * s) {
 	ls=log10(min_score);
 	printf("%f %f %i %i-%i ", ls, best_freq_shift, best_i, low, high);
 	for (i = 60; i < MAX_SAMPLES; i++) {
-		printf("%02i ", s->history[i]);
+		printf("%02i ", s->history[history_slot(s, i)]);
 	}
 	printf("\n");
 
@@ -407,26 +546,45 @@ void loop(STATE * s) {
 
 
 	int w;
-	double * t;
+	int slot;
 	
 	while (1) {
 
 		get_data_chunk(s);
-		t = add_e_history(s->e_history, MAX_SAMPLES);
-		do_fft(s, t);
-		w=pickwinner(t, 3, CUTOFF);
-		add_history(s->history, MAX_SAMPLES, w);
+		slot = add_e_history(s);
+		do_fft(s, s->e_history[slot], s->e_winners + slot);
+		w=range_winner(s->e_winners + slot, s->e_history[slot], 3, CUTOFF);
+		add_history(s, w);
 		check_history(s);
 
 	}
 }
 
-int main(void) {
+int main(int argc, char ** argv) {
 	STATE s;
+	PLANNER planner;
+	ARENA * arena = arena_create(16 << 20);
+	int i;
 	memset(&s, 0, sizeof(s));
+	memset(&planner, 0, sizeof(planner));
+	for (i = 1; i < argc; i++) {
+		if (!planner_arg(&planner, argc, argv, &i)) {
+			fprintf(stderr, "BAD ARGS\n");
+			exit(1);
+		}
+	}
 
-	setup_fftw(&s);
-	setup_e_history(s.e_history, MAX_SAMPLES);
+	planner_begin(&planner);
+	setup_fftw(&s, arena, planner.flags);
+	planner_end(&planner);
+	setup_e_history(arena, &s);
+	setup_logs();
+	/* An empty history is all bin 0, whose log is -inf */
+	for (i = 0; i < MAX_SAMPLES; i++) {
+		s.log_history[i] = bin_log[0];
+	}
+	arena_seal(arena);
+	fprintf(stderr, "MEMORY: %zu bytes\n", arena->used);
 
 	s.fd = 0;
 	loop(&s);
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Compare two engines over a directory of .pcm files.
+# usage: compare.sh DIR OUTPUT ENGINE [REFERENCE_ENGINE]
+# Appends the throughput and agreement report for each file to OUTPUT and
+# prints the totals at the end.
+
+ref=${4:-rotator}
+echo "" > $2
+
+for i in $1/*.pcm; do
+	echo RUNNING COMPARE $i
+	echo ================================================ >> $2
+	echo FILE:$i >> $2
+	./awesome -nodisplay -engine $3 -compare $ref < "$i" 2>&1 >/dev/null | grep '^KERNEL\|^COMPARE' >> $2
+done
+
+awk -v engine=$3 -v ref=$ref '
+	/^KERNEL/ { name=$2; sub(":", "", name); samples[name]+=$3; secs[name]+=$6 }
+	/^COMPARE/ { disagree+=$5; chunks+=$7 }
+	END {
+		printf("%s: %.0f samples/sec\n", engine, samples[engine]/secs[engine]);
+		printf("%s: %.0f samples/sec\n", ref, samples[ref]/secs[ref]);
+		printf("%i of %i chunks disagree\n", disagree, chunks);
+	}' $2
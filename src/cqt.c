@@ -0,0 +1,203 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+#include <complex.h>
+#include <fftw3.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "arena.h"
+#include "cqt.h"
+
+/*
+ * Spectral kernel entries smaller than this (relative to the largest
+ * entry for the same note) are dropped. This is what makes the kernel
+ * sparse; the energy lost is well under 0.1%.
+ */
+#define KERNEL_THRESHOLD 1e-3
+
+/*
+ * Kernel length in multiples of the shortest one that resolves adjacent
+ * semitones (about 17 periods). At 1 a note leaks into its neighbours at
+ * -6dB; at 2 the neighbours fall in the window's first null, and the
+ * kernel (~34 periods) is about as long as the filter bank's memory.
+ */
+#define CQT_RESOLUTION 2
+
+/*
+ * THEORY OF OPERATION
+ *
+ * Note bin i is the inner product of the latest samples with a temporal
+ * kernel t_i: a Hann-windowed complex exponential at freqs[i], Q periods
+ * long (see CQT_RESOLUTION). The
+ * windows are normalized to sum to 1, so a sine of amplitude A gives
+ * |CQ| = A/2 in its bin.
+ *
+ * By Parseval, sum(x * conj(t)) == sum(X * conj(T)) / N where X and T are
+ * the DFTs. Each T_i is concentrated in a few bins around freqs[i], so we
+ * precompute the significant conj(T_i)/N once and each hop is one FFT of
+ * the frame plus a short sparse dot product per note. Since x is real and
+ * T_i has (almost) no negative frequency content, the real FFT's
+ * non-negative half is all we need.
+ *
+ * Every kernel is aligned with the end of the frame so all notes look at
+ * the most recent audio; low notes just look further back.
+ */
+
+/*
+ * Build the sparse spectral kernel for every note. c->n and c->fft_size
+ * must already be set. The kernel is collected in scratch arrays that
+ * grow as needed and only copied into the arena once its size is known.
+ */
+static void cqt_build_kernel(ARENA * arena, CQT * c, const double * freqs,
+	double sample_freq, double q) {
+	int N = c->fft_size;
+	int half = N / 2 + 1;
+	int i, j;
+	int used = 0;
+	int capacity = 1024;
+	fftw_complex * t;
+	fftw_complex * T;
+	fftw_plan p;
+	int * index;
+	fftw_complex * value;
+
+	t = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * N);
+	T = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * N);
+	p = fftw_plan_dft_1d(N, t, T, FFTW_FORWARD, FFTW_ESTIMATE);
+
+	c->start = (int*)arena_alloc(arena, sizeof(int) * (c->n + 1));
+	index = (int*)malloc(sizeof(int) * capacity);
+	value = (fftw_complex*)malloc(sizeof(fftw_complex) * capacity);
+
+	for (i = 0; i < c->n; i++) {
+		int len = (int)ceil(q * sample_freq / freqs[i]);
+		double sum = 0;
+		double peak = 0;
+		if (len > N) {
+			len = N;
+		}
+		memset(t, 0, sizeof(fftw_complex) * N);
+		for (j = 0; j < len; j++) {
+			sum += 0.5 - 0.5 * cos(2*M_PI * (j + 0.5) / len);
+		}
+		for (j = 0; j < len; j++) {
+			int pos = N - len + j;
+			double w = (0.5 - 0.5 * cos(2*M_PI * (j + 0.5) / len)) / sum;
+			t[pos] = w * cexp(I * 2*M_PI * freqs[i] * pos / sample_freq);
+		}
+		fftw_execute(p);
+
+		for (j = 0; j < half; j++) {
+			if (cabs(T[j]) > peak) {
+				peak = cabs(T[j]);
+			}
+		}
+		c->start[i] = used;
+		for (j = 0; j < half; j++) {
+			if (cabs(T[j]) < peak * KERNEL_THRESHOLD) {
+				continue;
+			}
+			if (used == capacity) {
+				capacity *= 2;
+				index = (int*)realloc(index, sizeof(int) * capacity);
+				value = (fftw_complex*)realloc(value, sizeof(fftw_complex) * capacity);
+			}
+			index[used] = j;
+			value[used] = conj(T[j]) / N;
+			used++;
+		}
+	}
+	c->start[c->n] = used;
+	c->index = (int*)arena_alloc(arena, sizeof(int) * used);
+	c->value = (fftw_complex*)arena_alloc(arena, sizeof(fftw_complex) * used);
+	memcpy(c->index, index, sizeof(int) * used);
+	memcpy(c->value, value, sizeof(fftw_complex) * used);
+
+	fftw_destroy_plan(p);
+	fftw_free(t);
+	fftw_free(T);
+	free(index);
+	free(value);
+}
+
+/*
+ * Set up a constant-Q transform for |n| notes at |freqs| (Hz, ascending).
+ * |scale| is multiplied into each bin's |CQ|^2. |flags| are the FFTW
+ * planner flags for the per-hop FFT.
+ */
+CQT * cqt_create(ARENA * arena, const double * freqs, const double * scale, int n,
+	double sample_freq, unsigned flags) {
+	CQT * c;
+	double q = CQT_RESOLUTION / (pow(2, 1.0/12) - 1);
+	int longest = (int)ceil(q * sample_freq / freqs[0]);
+
+	c = (CQT*)arena_alloc(arena, sizeof(*c));
+	c->n = n;
+	c->fft_size = 1;
+	while (c->fft_size < longest) {
+		c->fft_size *= 2;
+	}
+
+	/* Arena memory is aligned well enough for FFTW's SIMD codelets */
+	c->frame = (double*)arena_alloc(arena, sizeof(double) * c->fft_size);
+	c->spectrum = (fftw_complex*)arena_alloc(arena, sizeof(fftw_complex) * (c->fft_size/2 + 1));
+	c->plan = fftw_plan_dft_r2c_1d(c->fft_size, c->frame, c->spectrum, flags);
+	/* Planning may scribble on the arrays, so clear the frame after */
+	memset(c->frame, 0, sizeof(double) * c->fft_size);
+
+	c->scale = (double*)arena_alloc(arena, sizeof(double) * n);
+	memcpy(c->scale, scale, sizeof(double) * n);
+	cqt_build_kernel(arena, c, freqs, sample_freq, q);
+	return c;
+}
+
+/* Slide new samples into the frame */
+void cqt_process(CQT * c, const double * x, int samples) {
+	int keep;
+	if (samples >= c->fft_size) {
+		memcpy(c->frame, x + samples - c->fft_size, sizeof(double) * c->fft_size);
+		return;
+	}
+	keep = c->fft_size - samples;
+	memmove(c->frame, c->frame + samples, sizeof(double) * keep);
+	memcpy(c->frame + keep, x, sizeof(double) * samples);
+}
+
+/*
+ * Transform the current frame and fill in |energy| with the scaled
+ * |CQ|^2 of every note bin.
+ */
+void cqt_energy(CQT * c, double * energy) {
+	int i, j;
+	fftw_execute(c->plan);
+	for (i = 0; i < c->n; i++) {
+		fftw_complex cq = 0;
+		for (j = c->start[i]; j < c->start[i+1]; j++) {
+			cq += c->spectrum[c->index[j]] * c->value[j];
+		}
+		energy[i] = creal(cq * conj(cq)) * c->scale[i];
+	}
+}
+
+/* Forget all input */
+void cqt_reset(CQT * c) {
+	memset(c->frame, 0, sizeof(double) * c->fft_size);
+}
+
+/*
+ * Like cqt_create, this plans (destroys a plan) so isn't thread safe. The
+ * rest goes with the arena.
+ */
+void cqt_destroy(CQT * c) {
+	fftw_destroy_plan(c->plan);
+}
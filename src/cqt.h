@@ -0,0 +1,44 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+/*
+ * Constant-Q transform: one real FFT per hop followed by a sparse
+ * "spectral kernel" that maps FFT bins onto note bins (Brown and
+ * Puckette's method). Include <complex.h>, <fftw3.h> and arena.h first.
+ * Everything but the FFTW plan lives in an ARENA.
+ */
+typedef struct {
+	/* Number of note bins and FFT length */
+	int n;
+	int fft_size;
+
+	/* The most recent fft_size samples, oldest first */
+	double * frame;
+	fftw_complex * spectrum;
+	fftw_plan plan;
+
+	/* Sparse kernel in compressed rows: note bin i uses FFT bins
+	 * index[start[i]] .. index[start[i+1]-1] with weights value[] */
+	int * start;
+	int * index;
+	fftw_complex * value;
+
+	/* Per-bin factor applied to |CQ|^2 */
+	double * scale;
+} CQT;
+
+CQT * cqt_create(ARENA * arena, const double * freqs, const double * scale, int n,
+	double sample_freq, unsigned flags);
+void cqt_process(CQT * c, const double * x, int samples);
+void cqt_energy(CQT * c, double * energy);
+void cqt_reset(CQT * c);
+void cqt_destroy(CQT * c);
@@ -0,0 +1,229 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation. 
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+#include <string.h>
+#include "format.h"
+
+/* Parse a sample format name. Returns -1 if we don't know it. */
+int format_parse(FORMAT * f, char * name) {
+	if (!strcmp(name, "s16le") || !strcmp(name, "s16")) {
+		f->sample_format = SAMPLE_S16;
+	} else if (!strcmp(name, "f32le") || !strcmp(name, "f32")) {
+		f->sample_format = SAMPLE_F32;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+/* Bytes in one frame (one sample for every channel) */
+int format_frame_bytes(const FORMAT * f) {
+	return f->channels * (f->sample_format == SAMPLE_F32 ? 4 : 2);
+}
+
+/* Parse a channel mix name. Returns -1 if we don't know it. */
+int mix_parse(MIX * m, char * name) {
+	if (!strcmp(name, "left")) {
+		*m = MIX_LEFT;
+	} else if (!strcmp(name, "mid")) {
+		*m = MIX_MID;
+	} else if (!strcmp(name, "side")) {
+		*m = MIX_SIDE;
+	} else if (!strcmp(name, "each")) {
+		*m = MIX_EACH;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+/* How many signals |m| makes of |f|'s channels, or -1 if it can't */
+int mix_streams(const FORMAT * f, MIX m) {
+	if (m == MIX_EACH) {
+		return f->channels;
+	}
+	if ((m == MIX_MID || m == MIX_SIDE) && f->channels < 2) {
+		return -1;
+	}
+	return 1;
+}
+
+/*
+ * Stereo frames are split SPLIT_FRAMES at a time: one (unaligned) load of
+ * interleaved samples, two shuffles to pull out the left and right
+ * channels, and a conversion of each half to doubles.
+ */
+#define SPLIT_FRAMES 8
+typedef short S16X2 __attribute__((vector_size(2 * SPLIT_FRAMES * sizeof(short))));
+typedef float F32X2 __attribute__((vector_size(2 * SPLIT_FRAMES * sizeof(float))));
+typedef double DV __attribute__((vector_size(SPLIT_FRAMES * sizeof(double))));
+
+#define EVEN 0, 2, 4, 6, 8, 10, 12, 14
+#define ODD 1, 3, 5, 7, 9, 11, 13, 15
+
+/* Write the left and right halves of one group of frames for |mix| */
+static inline void split_store(MIX mix, const DV * l, const DV * r, double ** out, int i) {
+	DV m;
+	switch (mix) {
+	case MIX_LEFT:
+		memcpy(out[0] + i, l, sizeof(*l));
+		break;
+	case MIX_MID:
+		m = (*l + *r) * 0.5;
+		memcpy(out[0] + i, &m, sizeof(m));
+		break;
+	case MIX_SIDE:
+		m = (*l - *r) * 0.5;
+		memcpy(out[0] + i, &m, sizeof(m));
+		break;
+	case MIX_EACH:
+		memcpy(out[0] + i, l, sizeof(*l));
+		memcpy(out[1] + i, r, sizeof(*r));
+		break;
+	}
+}
+
+/* The same for the odd frames left over at the end */
+static inline void split_store1(MIX mix, double l, double r, double ** out, int i) {
+	switch (mix) {
+	case MIX_LEFT:
+		out[0][i] = l;
+		break;
+	case MIX_MID:
+		out[0][i] = (l + r) * 0.5;
+		break;
+	case MIX_SIDE:
+		out[0][i] = (l - r) * 0.5;
+		break;
+	case MIX_EACH:
+		out[0][i] = l;
+		out[1][i] = r;
+		break;
+	}
+}
+
+#if defined(__x86_64__)
+__attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+static void split_s16_stereo(const short * in, MIX mix, double ** out, int frames) {
+	int i;
+	for (i = 0; i + SPLIT_FRAMES <= frames; i += SPLIT_FRAMES) {
+		S16X2 v;
+		DV l, r;
+		memcpy(&v, in + 2*i, sizeof(v));
+		l = __builtin_convertvector(__builtin_shufflevector(v, v, EVEN), DV);
+		r = __builtin_convertvector(__builtin_shufflevector(v, v, ODD), DV);
+		split_store(mix, &l, &r, out, i);
+	}
+	for (; i < frames; i++) {
+		split_store1(mix, in[2*i], in[2*i + 1], out, i);
+	}
+}
+
+#if defined(__x86_64__)
+__attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+static void split_f32_stereo(const float * in, MIX mix, double ** out, int frames) {
+	int i;
+	for (i = 0; i + SPLIT_FRAMES <= frames; i += SPLIT_FRAMES) {
+		F32X2 v;
+		DV l, r;
+		memcpy(&v, in + 2*i, sizeof(v));
+		l = __builtin_convertvector(__builtin_shufflevector(v, v, EVEN), DV) * 32768.0;
+		r = __builtin_convertvector(__builtin_shufflevector(v, v, ODD), DV) * 32768.0;
+		split_store(mix, &l, &r, out, i);
+	}
+	for (; i < frames; i++) {
+		split_store1(mix, in[2*i] * 32768.0, in[2*i + 1] * 32768.0, out, i);
+	}
+}
+
+/*
+ * Mono has only one thing to mix (left and each are the same, mid and
+ * side are refused by mix_streams), so it goes straight to out[0] and the
+ * compiler can vectorize the plain loop itself.
+ */
+#if defined(__x86_64__)
+__attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+static void split_s16_mono(const short * in, double * out, int frames) {
+	int i;
+	for (i = 0; i < frames; i++) {
+		out[i] = in[i];
+	}
+}
+
+#if defined(__x86_64__)
+__attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+static void split_f32_mono(const float * in, double * out, int frames) {
+	int i;
+	for (i = 0; i < frames; i++) {
+		out[i] = in[i] * 32768.0;
+	}
+}
+
+/* Sample |c| of frame |i| as a double */
+static inline double format_sample(const FORMAT * f, const void * in, int i, int c) {
+	if (f->sample_format == SAMPLE_S16) {
+		return ((const short*)in)[i * f->channels + c];
+	}
+	return ((const float*)in)[i * f->channels + c] * 32768.0;
+}
+
+/*
+ * Convert |frames| frames of raw input to doubles, mixed down as |mix|
+ * says: one signal in out[0], or with MIX_EACH one per channel in out[c].
+ * Floats are scaled to the 16 bit range so energies (and MINIMUM_ENERGY)
+ * mean the same thing whatever the format, and mid and side are halved so
+ * they stay in it too. Everything comes out of one pass over the input.
+ * Mono and stereo each have their own loops; only more channels than that
+ * go through the general one.
+ */
+void format_split(const FORMAT * f, MIX mix, const void * in, double ** out, int frames) {
+	int i, c;
+	if (f->channels == 1) {
+		if (f->sample_format == SAMPLE_S16) {
+			split_s16_mono((const short*)in, out[0], frames);
+		} else {
+			split_f32_mono((const float*)in, out[0], frames);
+		}
+		return;
+	}
+	if (f->channels == 2) {
+		if (f->sample_format == SAMPLE_S16) {
+			split_s16_stereo((const short*)in, mix, out, frames);
+		} else {
+			split_f32_stereo((const float*)in, mix, out, frames);
+		}
+		return;
+	}
+	for (i = 0; i < frames; i++) {
+		double l = format_sample(f, in, i, 0);
+		switch (mix) {
+		case MIX_LEFT:
+			out[0][i] = l;
+			break;
+		case MIX_MID:
+			out[0][i] = (l + format_sample(f, in, i, 1)) * 0.5;
+			break;
+		case MIX_SIDE:
+			out[0][i] = (l - format_sample(f, in, i, 1)) * 0.5;
+			break;
+		case MIX_EACH:
+			out[0][i] = l;
+			for (c = 1; c < f->channels; c++) {
+				out[c][i] = format_sample(f, in, i, c);
+			}
+			break;
+		}
+	}
+}
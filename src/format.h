@@ -0,0 +1,38 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation. 
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+/*
+ * What raw input looks like and how its channels are mixed down for
+ * analysis. The analyzer library includes this itself (see analyzer.h).
+ */
+
+/* Layout of the raw input. Multi-byte samples are little endian. */
+typedef enum {SAMPLE_S16, SAMPLE_F32} SAMPLE_FORMAT;
+
+typedef struct {
+	int sample_rate;
+	int channels;
+	SAMPLE_FORMAT sample_format;
+} FORMAT;
+
+int format_parse(FORMAT * f, char * name);
+int format_frame_bytes(const FORMAT * f);
+
+/*
+ * What to analyze: the first (left) channel, the mid (L+R)/2 or side
+ * (L-R)/2 of the first two, or every channel on its own.
+ */
+typedef enum {MIX_LEFT, MIX_MID, MIX_SIDE, MIX_EACH} MIX;
+
+int mix_parse(MIX * m, char * name);
+int mix_streams(const FORMAT * f, MIX m);
+void format_split(const FORMAT * f, MIX mix, const void * in, double ** out, int frames);
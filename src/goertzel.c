@@ -0,0 +1,99 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "arena.h"
+#include "goertzel.h"
+
+/*
+ * Bins are updated GOERTZEL_GROUP at a time using vector types, and the
+ * arrays are padded to a multiple of that. goertzel_process is compiled
+ * for several instruction sets and the best one is picked at load time.
+ */
+#define GOERTZEL_GROUP 4
+typedef double GROUP __attribute__((vector_size(GOERTZEL_GROUP * sizeof(double))));
+
+GOERTZEL * goertzel_create(ARENA * arena, int n) {
+	GOERTZEL * g;
+	int padded = (n + GOERTZEL_GROUP - 1) / GOERTZEL_GROUP * GOERTZEL_GROUP;
+	/* Arena memory is zeroed and aligned for a GROUP */
+	g = (GOERTZEL*)arena_alloc(arena, sizeof(*g));
+	g->n = n;
+	g->coeff = (double*)arena_alloc(arena, padded * sizeof(double));
+	g->s1 = (double*)arena_alloc(arena, padded * sizeof(double));
+	g->s2 = (double*)arena_alloc(arena, padded * sizeof(double));
+	g->scale = (double*)arena_alloc(arena, padded * sizeof(double));
+	return g;
+}
+
+/*
+ * Set up bin |i| to detect a phase step of |step| radians per sample.
+ * The step doesn't have to be a whole number of cycles per block.
+ */
+void goertzel_set_bin(GOERTZEL * g, int i, double step, double scale) {
+	g->coeff[i] = 2 * cos(step);
+	g->scale[i] = scale;
+}
+
+/*
+ * Run the recurrence s = x + 2cos(w)*s1 - s2 over a block. Blocks may be
+ * fed in pieces; the DFT covers everything since the last goertzel_energy.
+ */
+#if defined(__x86_64__)
+__attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+void goertzel_process(GOERTZEL * g, const double * x, int samples) {
+	int i, j;
+	GROUP * c = (GROUP*)g->coeff;
+	GROUP * s1 = (GROUP*)g->s1;
+	GROUP * s2 = (GROUP*)g->s2;
+	int groups = (g->n + GOERTZEL_GROUP - 1) / GOERTZEL_GROUP;
+	for (i = 0; i < samples; i++) {
+		double delta = x[i];
+		for (j = 0; j < groups; j++) {
+			GROUP s = delta + c[j] * s1[j] - s2[j];
+			s2[j] = s1[j];
+			s1[j] = s;
+		}
+	}
+	g->samples += samples;
+}
+
+/*
+ * Fill in |energy| with the scaled power at every bin,
+ * |X|^2 * scale / samples^2, and start a new block.
+ */
+void goertzel_energy(GOERTZEL * g, double * energy) {
+	int j;
+	double n2 = (double)g->samples * g->samples;
+	for (j = 0; j < g->n; j++) {
+		double s1 = g->s1[j];
+		double s2 = g->s2[j];
+		double power = s1*s1 + s2*s2 - g->coeff[j]*s1*s2;
+		energy[j] = n2 > 0 ? power * g->scale[j] / n2 : 0;
+		g->s1[j] = 0;
+		g->s2[j] = 0;
+	}
+	g->samples = 0;
+}
+
+/* Drop the current block */
+void goertzel_reset(GOERTZEL * g) {
+	int j;
+	for (j = 0; j < g->n; j++) {
+		g->s1[j] = 0;
+		g->s2[j] = 0;
+	}
+	g->samples = 0;
+}
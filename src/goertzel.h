@@ -0,0 +1,36 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+/*
+ * Block Goertzel detector: the DFT of one block evaluated at a few
+ * arbitrary frequencies, one multiply-add per sample per bin. Unlike the
+ * filter bank there is no smoothing from one block to the next.
+ * Include arena.h first.
+ */
+typedef struct {
+	int n;
+	/* Samples seen since the last goertzel_energy */
+	int samples;
+	/* 2*cos(step) for each bin */
+	double * coeff;
+	/* Last two values of the recurrence */
+	double * s1;
+	double * s2;
+	/* Per-bin factor applied to |X|^2/samples^2 */
+	double * scale;
+} GOERTZEL;
+
+GOERTZEL * goertzel_create(ARENA * arena, int n);
+void goertzel_set_bin(GOERTZEL * g, int i, double step, double scale);
+void goertzel_process(GOERTZEL * g, const double * x, int samples);
+void goertzel_energy(GOERTZEL * g, double * energy);
+void goertzel_reset(GOERTZEL * g);
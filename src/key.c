@@ -19,6 +19,9 @@ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
 #include <errno.h>
 #include <unistd.h>
 #include "shared.h"
+#include "format.h"
+#include "arena.h"
+#include "planner.h"
 
 /* What is the input sample rate */
 #define SAMPLE_RATE 44100
@@ -30,10 +33,12 @@ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
 
 #define LEN(x) (sizeof(x)/sizeof(x[0]))
 
-/* What are the frequencies and names of notes */
-double note_table[] = {65.41, 69.30, 73.42, 77.78, 82.41, 87.31, 92.50, 98.00, 103.93, 110.00, 116.54, 123.47};
-char *note_names[] = {
-	"C ", "C#", "D ", "D#", "E ", "F ", "F#", "G ", "G#", "A ", "A#", "B "};
+/*
+ * Range of FFT bins that bucketize looks at. Nothing outside it is
+ * computed.
+ */
+#define FIRST_BIN 26
+#define LAST_BIN (CHUNK_SIZE/16)
 
 /* Helper array that (once filled in) associates each frequency to
  * an note as an index into note_table and note_names. 
@@ -48,15 +53,26 @@ int bucket_to_note[CHUNK_SIZE];
  * things.
  */
 typedef struct {
-	/* FFTW plan and input and output array */
+	/* FFTW plan and input and output array. The input is real so we
+	 * only get the CHUNK_SIZE/2+1 non-negative frequencies back. */
 	fftw_plan fftwplan;
-	fftw_complex  * fftw_in;
+	double  * fftw_in;
 	fftw_complex  * fftw_out;
 
 	/* This is the array of audio samples. We expect samples
  	 * Stereo, signed, 16 bit little endian PCM format */
 	short tmpdata[CHUNK_SIZE * 2];
 
+	/* The last CHUNK_SIZE (left channel) samples, oldest first */
+	double frame[CHUNK_SIZE];
+	/* Analysis window, scaled so a sine's peak is the same as with
+	 * no window */
+	double window[CHUNK_SIZE];
+	/* How many new samples we read between FFTs */
+	int hop;
+	/* Which channel (or mix of both) to analyze */
+	MIX mix;
+
 	/* A processed array with the total energy at each frequency */
 	double energy[CHUNK_SIZE];
 
@@ -128,16 +144,39 @@ void build_bucket_to_note() {
 }
 
 /*
- * Allocate arrays for fftw and setup a fft plan 
+ * Allocate arrays for fftw (in |arena|, which is aligned well enough) and
+ * setup a fft plan 
  */
-void setup_fftw(STATE * s) {
-	s->fftw_in= (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * CHUNK_SIZE);
-	s->fftw_out= (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * CHUNK_SIZE);
+void setup_fftw(STATE * s, ARENA * arena, unsigned flags) {
+	s->fftw_in= (double*)arena_alloc(arena, sizeof(double) * CHUNK_SIZE);
+	s->fftw_out= (fftw_complex*)arena_alloc(arena, sizeof(fftw_complex) * (CHUNK_SIZE/2 + 1));
 
-	s->fftwplan = fftw_plan_dft_1d(CHUNK_SIZE,
+	s->fftwplan = fftw_plan_dft_r2c_1d(CHUNK_SIZE,
 			s->fftw_in,
 			s->fftw_out,
-			FFTW_FORWARD,FFTW_MEASURE);
+			flags);
+}
+
+/*
+ * Fill in the analysis window. "hann" tapers the frame so that
+ * overlapping frames don't leak; "rect" is no window at all (what we
+ * used to do). Without -window, a hop shorter than the frame gets "hann"
+ * and a full frame hop gets "rect": tapering frames that don't overlap
+ * would just throw away the signal at their edges.
+ */
+void setup_window(STATE * s, char * name) {
+	int i;
+	for (i = 0; i < CHUNK_SIZE; i++) {
+		if (!strcmp(name, "rect")) {
+			s->window[i] = 1.0;
+		} else if (!strcmp(name, "hann")) {
+			/* A Hann window has a coherent gain of 1/2 */
+			s->window[i] = 1.0 - cos(2*M_PI * i / CHUNK_SIZE);
+		} else {
+			fprintf(stderr, "UNKNOWN WINDOW: %s\n", name);
+			exit(1);
+		}
+	}
 }
 
 
@@ -149,10 +188,11 @@ void error(char * s) {
 
 
 /*
- * Read raw data into memory. Put it in s->tmpdata
+ * Read one hop of raw data into memory. Put it in s->tmpdata.
+ * Returns -1 at the end of the input.
  */
-int get_data_chunk(STATE * s) {
-	int left_to_read = CHUNK_SIZE * 2 * 2;
+int read_chunk(STATE * s) {
+	int left_to_read = s->hop * 2 * 2;
 	int pos = 0;
 
 	while (left_to_read > 0) {
@@ -161,6 +201,9 @@ int get_data_chunk(STATE * s) {
 		if (len <0) {
 			error(strerror(errno));
 		}
+		if (len == 0) {
+			return -1;
+		}
 		pos+=len;
 
 		left_to_read-=len;
@@ -169,23 +212,30 @@ int get_data_chunk(STATE * s) {
 }
 
 /*
- * This does the FFT, computing s->energy froms->tmpdata
+ * This does the FFT, computing s->energy froms->tmpdata. Each call slides
+ * the frame forward by one hop, so frames overlap when the hop is shorter
+ * than CHUNK_SIZE.
  */
 int do_fft(STATE * s) {
 
+	static const FORMAT stereo = {SAMPLE_RATE, 2, SAMPLE_S16};
 	int i;
-	/* Input is in stereo so we only care about every other sample */
+	int keep = CHUNK_SIZE - s->hop;
+	double * out = s->frame + keep;
+	memmove(s->frame, s->frame + s->hop, sizeof(double) * keep);
+	/* Input is in stereo; pull out the one signal we analyze */
+	format_split(&stereo, s->mix, s->tmpdata, &out, s->hop);
 	for (i = 0; i < CHUNK_SIZE; i++) {
-		s->fftw_in[i] = s->tmpdata[i*2];
+		s->fftw_in[i] = s->frame[i] * s->window[i];
 	}
 
 	/* FFT */
 	fftw_execute(s->fftwplan);
 
-	/* Now compute the energy in each frequency*/
-	for (i = 0; i < CHUNK_SIZE; i++) {
-		s->energy[i] = (s->fftw_out[i] * conj(s->fftw_out[i]));
-		
+	/* Now compute the energy in each frequency that bucketize uses */
+	for (i = FIRST_BIN; i < LAST_BIN; i++) {
+		s->energy[i] = creal(s->fftw_out[i]) * creal(s->fftw_out[i]) +
+			cimag(s->fftw_out[i]) * cimag(s->fftw_out[i]);
 	}
 
 	return 0;
@@ -200,13 +250,13 @@ int do_fft(STATE * s) {
  */
 int bucketize(STATE * s, double * bucket, int *tcount) {
 
-	double total_energy;
+	double total_energy = 0;
 	double min_energy;
 	int i;
 
 	memset(bucket, 0, LEN(note_table) * sizeof(double));
 
-	for (i= 26; i < CHUNK_SIZE/16; i++) {
+	for (i= FIRST_BIN; i < LAST_BIN; i++) {
 		int b;
 		total_energy +=s->energy[i];
 		b = bucket_to_note[i];
@@ -243,7 +293,9 @@ void loop(STATE * s, SCALE * scale, int scale_n) {
 	
 	while (1) {
 
-		get_data_chunk(s);
+		if (read_chunk(s) < 0) {
+			break;
+		}
 		do_fft(s);
 		if (last_scale) {
 			fprintf(stderr, "SCALE: %s \t", last_scale->name);
@@ -258,14 +310,49 @@ void loop(STATE * s, SCALE * scale, int scale_n) {
 	}
 }
 
-int main(void) {
+int main(int argc, char ** argv) {
 	STATE s;
 	SCALE * scale;
 	int scale_n;
-	build_all_scales(&scale, &scale_n);
+	PLANNER planner;
+	ARENA * arena = arena_create(1 << 20);
+	char * window = NULL;
+	int i;
+	memset(&s, 0, sizeof(s));
+	memset(&planner, 0, sizeof(planner));
+	s.hop = CHUNK_SIZE;
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-hop") && i + 1 < argc) {
+			/* Hop in milliseconds */
+			s.hop = atoi(argv[++i]) * SAMPLE_RATE / 1000;
+			if (s.hop < 1 || s.hop > CHUNK_SIZE) {
+				fprintf(stderr, "HOP MUST BE 1-%i ms\n", 1000 / TIME);
+				exit(1);
+			}
+		} else if (!strcmp(argv[i], "-window") && i + 1 < argc) {
+			window = argv[++i];
+		} else if (!strcmp(argv[i], "-mix") && i + 1 < argc) {
+			/* left, mid or side */
+			if (mix_parse(&s.mix, argv[++i]) < 0 || s.mix == MIX_EACH) {
+				fprintf(stderr, "UNKNOWN MIX: %s\n", argv[i]);
+				exit(1);
+			}
+		} else if (!planner_arg(&planner, argc, argv, &i)) {
+			fprintf(stderr, "BAD ARGS\n");
+			exit(1);
+		}
+	}
+	build_all_scales(arena, &scale, &scale_n);
 	build_bucket_to_note2();
+	if (!window) {
+		window = s.hop < CHUNK_SIZE ? "hann" : "rect";
+	}
+	setup_window(&s, window);
 
-	setup_fftw(&s);
+	planner_begin(&planner);
+	setup_fftw(&s, arena, planner.flags);
+	planner_end(&planner);
+	arena_seal(arena);
 
 	s.fd = 0;
 	loop(&s, scale, scale_n);
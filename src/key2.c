@@ -10,262 +10,69 @@ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
 */
 
 
+
 #define _GNU_SOURCE
+#include <complex.h>
+#include <fftw3.h>
 #include <stdlib.h>
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
 #include "shared.h"
-
-
-/* What is the input sample rate */
-#define SAMPLE_RATE 44100
-/* How to quantize one second */
-#define TIME 10
-/* How many samples will we work with at once */
-#define CHUNK_SIZE (SAMPLE_RATE/TIME)
+#include "arena.h"
+#include "analyzer.h"
+#include "planner.h"
+#include "ring.h"
+#ifdef COUNT_ALLOCS
+#include "allocs.h"
+#endif
 
 /*
- * How many octaves will we consider? 
+ * The command line front end to the analyzer (see analyzer.h): reads raw
+ * audio from stdin, a file in segments, or a batch of files, and prints
+ * the notes and scale.
  */
-#define OCTAVES 5
-
-/*
- * What is the minimun energy to care about a note 
- */
-#define MINIMUM_ENERGY 1e9
 
 #define LEN(x) (sizeof(x)/sizeof(x[0]))
 
 /*
- * THEORY OF OPERATION
- *
- * Consutrct one "filter" for every note that we want to recognize. 
- * We compute the running projection of each new sample into a sine and
- * cosine wave of each note. (This is essentially like taking a fourier
- * transofrm but we're only interested in certain notes.)
- *
- * We keep a running "total" of the sin and cos part but we decimate
- * decrease it (by a small factor) each sample to keep things current.
- *
- * We can then pick out which notes are present by finding the notes
- * with the highest relative energy defines by the sum of the squares
- * of the sine and cosine parts.
- */
-typedef struct FILTER{
-	/* What is the wavelength of this note in samples */
-	int length;
-	/* What sample of the wavelength are we on */
-	int index;
-	/* What factor do we decimate by on each sample */
-	double rolloff;
-	/* normalizer == 1/length. This adjusts for the fact that
-	 * we don't count all frequencies fairly. (lower frequencies are
-	 * "longer" and accumulate more energy... Is this right?)
-	 */
-	double normalizer;
-
-	/* What do we call this note */
-	char * name;
-
-	/* Projected amplitue onto the sine and cosine waves */
-	double xsin;
-	double xcos;
-
-	double accumulator;
-	double max;
-	
-} FILTER;
-
-
-/* Get the total (sine + cosine) energy in a particular filter.
- * This gets the average energy in the filter since the last time
- * filter_energy was called (which should be exactly once per
- * CHUNK_SIZE samples).
- */
-double filter_energy_average(FILTER * f) {
-	double e = f->accumulator;
-	f->accumulator = 0;
-	return e * f->normalizer / CHUNK_SIZE;
-}
-
-double filter_energy_max(FILTER * f) {
-	double e = f->max;
-	f->max = 0;
-	return e * f->normalizer;
-}
-
-/* Update a filter with a new sample */
-void filter_touch(FILTER * f, double delta) {
-	double e;
-	/* What is the current phase angle?*/
-	double rad = 2*M_PI * (double)f->index / (double)f->length;
-	/* Update sine and cosine parts */
-	f->xsin = f->xsin * f->rolloff + delta *  sin(rad);
-	f->xcos = f->xcos * f->rolloff + delta *  cos(rad);
-	/* Update the index */
-	f->index = (f->index+1) % f->length;
-
-	/* Update accumulator which we will use to keep track of the
-	 * average energy over a sampl.
-	 */
-
-	e = (f->xsin*f->xsin) + (f->xcos*f->xcos);
-
-	if (e> f->max) {
-		f->max= e;
-	}
-	f->accumulator += (f->xsin*f->xsin) + (f->xcos*f->xcos);
-}
-
-
-/*
- * Try to be clever about picking the rolloff. The idea is that for
- * each note we'll pick a decay factor that's some big (like 20) multiple
- * of the period in samples. The equation comes from:
- *
- * X_0 = v; x_n = a*x_(n-1).  Let X_n = v/2.
- * v/2 = a*x_n-1 --> v/2 = a^n*v --> a^n = 1/2. 
- * Therefore, a = exp(ln(1/2)/n).
- * When we do, this we also need to introduce a normalization factor of
- * (1-a). 
- */
-double halflife_to_rolloff(double halflife) {
-	return exp(-.6931/halflife);
-}
-
-/*
- * What normalization factor do we need to apply during filter_energy
- * to compensate for the decay factor above?
- *
- * This comes from:  x_n == a(x_(n-1)) +v.
- * But in the steady state, we have x_n==x_(n-1) so
- * x_n = a*(x_n) + v --> x_n = v/(1-a). 
- *
- * The factor of 1000 is essentially arbitrary but is calibrated against
- * some cutoffs in other code and generally makes the normalizing factors
- * close to 1.0
- */
-double normalizer_from_rolloff(double rolloff) {
-	return 1000 * (1 - rolloff);
-}
-
-/*
- * Setup a bunch of filters from a table of notes.
- */
-FILTER * make_filters(double * note_table,
-	char ** names,
-	int notes,
-	int octaves,
-	double sample_freq) {
-
-	int space = notes * octaves;
-	int n,o;
-
-	/* Current octave multiplyer */
-	double mult = 1.0;
-	FILTER * fs;
-	fs = (FILTER*)malloc(sizeof(*fs) * space);
-	memset(fs, 0, sizeof(*fs) * space);
-
-	/* Loop over each note of each octave */
-	for (o = 0; o < octaves; o++) {
-		for (n = 0; n < notes; n++) {
-			/* Built filter structure for this note */
-			int len;
-			double freq;
-			FILTER * cur;
-			/* What is the frequency of this note? */
-			freq = mult * note_table[n];
-			/* What is the "wavelength" measure in samples */
-			len = sample_freq / freq;
-			/* What is the fs object that we're setting up */
-			cur = fs+(n + notes *o);
-			cur->length = len;
-			cur->index = 0;
-			cur-> rolloff = halflife_to_rolloff(len*16);
-		//	cur-> rolloff = halflife_to_rolloff(8 * CHUNK_SIZE);
-			cur->normalizer = normalizer_from_rolloff(cur->rolloff);
-			asprintf(&cur->name, "%i%s", o, names[n]);
-	//		fprintf(stderr, "%s: %f %f %f %i (%i:%i)\n",
-	//			cur->name, freq, cur->rolloff, cur->normalizer, len, o, n);
-		}
-		/* Don't forget to udpate the octave! */
-		mult*=2.0;
-	}
-
-	return fs;
-}
-
-/*
- * Update an entire filter bank with a new sample */
-void  update_filters(FILTER * fs, int n, short sample) {
+ * Print the notes present to |out| */
+void fprint_notes(FILE * out, int * notes_present) {
 	int i;
-	double s = sample;
-	for (i = 0; i < n; i++) {
-		filter_touch(fs+i, s);
-	}
-}
-
-/* Guess which note (ignoring octave) are present 
- * |fs| a filter bank
- * |energy| a pre-allocated array of octaves*notes doubles
- * |notes_present| a pre-allocated array of ints. notes that are present will be set to 1
- * */
-double filter_guess_notes(FILTER * fs,
-	double * energy,
-	int notes,
-	int octaves,
-	int *notes_present,
-	double sample_energy) {
-
-	int i;
-	double total_energy = 0;
-	int n = notes * octaves;
-	int note, octave;
-
-	/* Clear notes */
-	memset(notes_present, 0, sizeof(*notes_present) * notes);
-
-	/* Pre-compute the energy for each note and accumulate the total energy.
-	 * XXX: Is this right? Do we want to use the combined energy of all
-	 * filters or the current sample energy???
-	 */
-	for (i = 0; i < n; i++) {
-		double e = filter_energy_max(fs+i);
-		//total_energy += filter_energy_average(fs+i);
-		total_energy +=e;
-		energy[i] = e;
-	}
-
-	total_energy *=1;
-	/* Iterate over all notes.  Mark notes that have enough energy. */
-	for (octave = 0; octave < octaves; octave ++) {
-		for (note = 0; note < notes; note++) {
-			double e;
-			e = energy[note + notes * octave];
-			/* Count something as a note if it has at last
-			 * 1/10 of the energy as well as a minimum energy
-			 */
-			if (e > total_energy / 10 && e > MINIMUM_ENERGY) {
-				notes_present[note] = 1;
-			}
+	for (i = 0; i < 12; i++) {
+		if (notes_present[i]) {
+			fprintf(out, "%s ", note_names[i]);
+		} else {
+			fprintf(out, "   ");
 		}
 	}
-	return total_energy;
+	fprintf(out, "\n");
 }
 
 /*
  * Dump notes to STDOUT */
 void dump_notes(int * notes_present) {
-	int i;
-	for (i = 0; i < 12; i++) {
-		if (notes_present[i]) {
-			printf("%s ", note_names[i]);
-		} else {
-			printf("   ");
+	fprint_notes(stdout, notes_present);
+}
+
+/*
+ * Dump the notes of every stream (see -mix each) to STDOUT on one line.
+ * |notes_present| holds 12 ints for each stream in turn. */
+void dump_stream_notes(int * notes_present, int streams) {
+	int s, i;
+	for (s = 0; s < streams; s++) {
+		if (s > 0) {
+			printf("| ");
+		}
+		for (i = 0; i < 12; i++) {
+			printf("%s ", notes_present[12 * s + i] ? note_names[i] : "  ");
 		}
 	}
 	printf("\n");
@@ -275,9 +82,11 @@ void dump_notes(int * notes_present) {
  * Dump energies to STDOUT in a pleasant way */
 void dump_energies(double * energy, double total_energy, int notes, int octaves) {
 	int i, octave, note;
+	int per_note = notes / LEN(note_names);
 	printf("\ec\n");
+	/* Only the bin right on (or just below) each note is labeled */
 	for (i = 0; i < notes; i++) {
-		printf("\t%s", note_names[i]);
+		printf("\t%s", i % per_note == (per_note - 1) / 2 ? note_names[i / per_note] : "");
 	}
 	printf("\n");
 	for (octave = 0; octave < octaves; octave++) {
@@ -309,22 +118,69 @@ void dump_energies(double * energy, double total_energy, int notes, int octaves)
 }
 
 
+typedef struct {
+	/* 0: nothing, 1: the full energy display, 2: one line of notes per
+	 * chunk (handy for diffing runs) */
+	int enable_display;
+	int max;
+	/* Kernel, input format, hop, gate and threads for every analyzer */
+	ANALYZER_CONFIG config;
+	/* Run a second filter bank with this kernel on the same input and
+	 * report how often it disagrees (-1 if disabled) */
+	int compare;
+	/* FFTW wisdom and planner flags (KERNEL_CQT) */
+	PLANNER planner;
+	/* Offline mode: split a file into this many segments and analyze
+	 * them in parallel (0 == off), each preceded by |warmup| chunks that
+	 * are processed but not reported */
+	int segments;
+	int warmup;
+	/* Batch mode: a directory of .pcm files or a file listing them
+	 * ("-" for stdin), and how many files to work on at once */
+	char * batch;
+	int jobs;
+	/* Capture on a separate thread through a ring of this many chunks
+	 * (0 == read on the analysis thread) */
+	int ring;
+	/* Read |read_ms| (a multiple of config.hop_ms) at a time */
+	int read_ms;
+	/* Print every hop where the -compare engine disagrees */
+	int validate;
+} OPTIONS;
+
+/* Build an analyzer running |kernel| with the rest of the options */
+ANALYZER * make_analyzer(KERNEL kernel, OPTIONS * opt) {
+	ANALYZER_CONFIG c = opt->config;
+	ANALYZER * a;
+	c.kernel = kernel;
+	c.planner_flags = opt->planner.flags;
+	a = analyzer_create(&c);
+	if (!a) {
+		exit(1);
+	}
+	return a;
+}
+
+/* Frames read at once: a whole number of hops */
+int chunk_frames(ANALYZER * a, OPTIONS * opt) {
+	return analyzer_hop(a) * (opt->read_ms / opt->config.hop_ms);
+}
+
+int chunk_bytes(ANALYZER * a, OPTIONS * opt) {
+	return chunk_frames(a, opt) * format_frame_bytes(&opt->config.format);
+}
+
 /*
- * Process a bunch of samples.  There is a high system-call overhead to
- * getting samples so we don't retrieve samples one at a time. Instead, 
- * loop2, will retrieve them at the display-update rate. process_chunk will
- * loop through every sample ina chunk and update its filter bank. 
+ * Push one hop of raw input and take its results, one per stream, into
+ * r[0 .. analyzer_streams(a)-1]. The queue is never left holding
+ * anything, so this always gets them all.
  */
-double process_chunk(short * input, FILTER * fs, int n_filter) {
-	int i;
-	double sample_energy = 0;
-	for (i = 0; i < CHUNK_SIZE; i++) {
-		short s;
-		s = input[i*2];
-		update_filters(fs, n_filter, s);
-		sample_energy += s*s;
-	}
-	return sample_energy;
+void analyze_hop(ANALYZER * a, const void * frames, ANALYZER_RESULT * r) {
+	int s;
+	analyzer_push(a, frames, analyzer_hop(a));
+	for (s = 0; s < analyzer_streams(a); s++) {
+		analyzer_poll(a, r + s);
+	}
 }
 
 void dump_accumulator(int * in, int n) {
@@ -344,41 +200,322 @@ void update_accumulator(int * in, int * out, int n) {
 }
 
 
-void loop2(FILTER * fs, SCALE * scales, int scale_n, int enable_display, int max) {
+/* Wall clock time in seconds, for throughput reports */
+double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void report_throughput(char * name, long samples, double seconds) {
+	fprintf(stderr, "KERNEL %s: %li samples in %.3fs (%.0f samples/sec)\n",
+		name, samples, seconds, seconds > 0 ? samples / seconds : 0);
+}
+
+/*
+ * Compare the output of two filter banks for the same chunk. Returns 1 if
+ * they disagree about which notes are present. The worst energy error
+ * (relative to the total filter energy) is tracked in |max_err|.
+ */
+int compare_chunk(double * energy, double * ref_energy, double ref_total,
+	int * notes_present, int * ref_notes_present, int n, int notes,
+	double * max_err) {
+	int i;
+	for (i = 0; i < n; i++) {
+		double err = fabs(energy[i] - ref_energy[i]);
+		if (ref_total > 0 && err / ref_total > *max_err) {
+			*max_err = err / ref_total;
+		}
+	}
+	return memcmp(notes_present, ref_notes_present, sizeof(*notes_present) * notes) != 0;
+}
 
-	short tmpdata[CHUNK_SIZE*2*2];
-	double energy[LEN(note_table) * OCTAVES];
-	double se;
-	double fe;
-	int notes_present[LEN(note_table)];
+void loop2(ANALYZER * fs, ANALYZER * ref, SCALE * scales, int scale_n, OPTIONS * opt) {
+
+	INPUT in;
+	RING * ring = NULL;
+	char * tmpdata;
+	int streams = analyzer_streams(fs);
+	ANALYZER_RESULT r[streams];
+	ANALYZER_RESULT ref_r[streams];
+	int notes_present[LEN(note_table) * streams];
+	ANALYZER_STATS stats;
+	int hop = analyzer_hop(fs);
+	int frames = chunk_frames(fs, opt);
+	int frame_bytes = format_frame_bytes(&opt->config.format);
+	double t;
 	int notes_accumulator[LEN(note_table)];
 	int count = 0;
+	int chunks = 0;
+	int compared = 0;
+	int disagree = 0;
+	long samples = 0;
+	double elapsed = 0;
+	double ref_elapsed = 0;
+	double max_err = 0;
+	int max = opt->max;
+	int stop = 0;
+	int s;
+#ifdef COUNT_ALLOCS
+	long allocs;
+#endif
 	memset(notes_accumulator, 0, sizeof(notes_accumulator));
 	SCALE * scale = NULL;
 
-	while(1) {
+	if (opt->ring > 0) {
+		ring = ring_create(0, chunk_bytes(fs, opt), opt->ring);
+	} else {
+		input_open(&in, 0, chunk_bytes(fs, opt));
+	}
+	while(!stop) {
+		int h;
 		/* Grab a chunks worth of data */
-		if ( get_data_chunk(tmpdata, CHUNK_SIZE) < 0) {
+		tmpdata = ring ? ring_next(ring) : input_next(&in);
+		if (tmpdata == NULL) {
 			break;
 		}
-		/* Update the filter bank */
-		se = process_chunk(tmpdata, fs, OCTAVES * LEN(note_table));
-		/* Extract notes */
-		fe = filter_guess_notes(fs,
-				energy,
-				LEN(note_table),
-				OCTAVES,
-				notes_present, 
-				se);
-
-		update_accumulator(notes_present, notes_accumulator, LEN(note_table));
+		/* Extract notes after every hop */
+		for (h = 0; h < frames && !stop; h += hop) {
+			/* Update the filter bank */
+			t = now();
+			analyze_hop(fs, tmpdata + (size_t)h * frame_bytes, r);
+			elapsed += now() - t;
+			samples += hop;
+			chunks++;
+
+			if (ref) {
+				t = now();
+				analyze_hop(ref, tmpdata + (size_t)h * frame_bytes, ref_r);
+				ref_elapsed += now() - t;
+			}
+			for (s = 0; ref && s < streams; s++) {
+				compared++;
+				if (compare_chunk(r[s].energy, ref_r[s].energy, ref_r[s].total_energy,
+						r[s].notes_present, ref_r[s].notes_present,
+						opt->config.bins * opt->config.octaves, LEN(note_table),
+						&max_err)) {
+					disagree++;
+					if (opt->validate) {
+						fprintf(stderr, "VALIDATE %i %-9s ", chunks - 1,
+							kernel_names[opt->config.kernel]);
+						fprint_notes(stderr, r[s].notes_present);
+						fprintf(stderr, "VALIDATE %i %-9s ", chunks - 1,
+							kernel_names[opt->compare]);
+						fprint_notes(stderr, ref_r[s].notes_present);
+					}
+				}
+			}
+
+			/* Every stream counts towards the scale */
+			for (s = 0; s < streams; s++) {
+				memcpy(notes_present + LEN(note_table) * s, r[s].notes_present,
+					sizeof(r[s].notes_present));
+				update_accumulator(r[s].notes_present, notes_accumulator, LEN(note_table));
+			}
+			if ( max > 0 && count > max) {
+				stop = 1;
+				break;
+			}
+
+			/* Periodically (once we've generated enough note counts)
+			 * try to guess the scale.
+			 */
+			if (count > 1000) {
+				scale = guess_scale(scales, scale_n, notes_accumulator);
+				memset(notes_accumulator, 0, sizeof(notes_accumulator));
+				count = 0;
+				if (scale) printf("SCALE: %s\n", scale->name);
+			}
+			count++;
+
+			if (opt->enable_display == 2) {
+				dump_stream_notes(notes_present, streams);
+			} else if (opt->enable_display) {
+				/* Update the display (energies for the first stream) */
+				dump_energies(r[0].energy, r[0].total_energy,
+					opt->config.bins, opt->config.octaves);
+				dump_accumulator(notes_accumulator, LEN(note_table));
+				//printf("%i\n", count);
+				if (scale) printf("SCALE: %s\t", scale->name);
+				dump_stream_notes(notes_present, streams);
+			}
+#ifdef COUNT_ALLOCS
+			/* stdio sets up its buffers on first use, so start
+			 * counting once everything has run once */
+			if (chunks == 1) {
+				alloc_count_start();
+			}
+#endif
+		}
+	}
+#ifdef COUNT_ALLOCS
+	allocs = alloc_count();
+#endif
+	if (!ring) {
+		input_close(&in);
+	}
+	printf("DONEDONE! %i\n", count);
+	scale = guess_scale(scales, scale_n, notes_accumulator);
+	if (scale) printf("SCALE: %s\n", scale->name);
+
+	report_throughput(kernel_names[opt->config.kernel], samples, elapsed);
+	analyzer_stats(fs, &stats);
+	fprintf(stderr, "MEMORY: %zu bytes, %zu per stream\n", stats.bytes, stats.stream_bytes);
+#ifdef COUNT_ALLOCS
+	fprintf(stderr, "ALLOCS: %li after the first hop\n", allocs);
+#endif
+	if (stats.gate >= 0) {
+		fprintf(stderr, "GATE: %li of %li hops below %g gated\n",
+			stats.gated, stats.hops, stats.gate);
+	}
+	if (ring) {
+		ring_report(ring);
+	}
+	if (ref) {
+		report_throughput(kernel_names[opt->compare], samples, ref_elapsed);
+		fprintf(stderr, "COMPARE %s vs %s: %i of %i chunks disagree, max energy error %g of total\n",
+			kernel_names[opt->config.kernel], kernel_names[opt->compare],
+			disagree, compared, max_err);
+	}
+}
+
+/*
+ * Offline analysis of a file in parallel. The filters only remember the
+ * last few half-lives of input (a fraction of a second even for the lowest
+ * octave), so a segment that starts |warmup| chunks early has forgotten
+ * where it started by the time it reaches its first reported chunk. Each
+ * segment runs on its own thread with its own analyzer and records the
+ * notes present after each hop; the frames are then replayed in order
+ * through the same scale logic as loop2.
+ */
+typedef struct {
+	pthread_t thread;
+	ANALYZER * a;
+	OPTIONS * opt;
+	/* First chunk processed, first chunk reported and one past the last */
+	int warm;
+	int first;
+	int last;
+	/* Shared with the other segments, LEN(note_table) ints per hop
+	 * and stream */
+	int * frames;
+} SEGMENT;
+
+static void * segment_main(void * arg) {
+	SEGMENT * seg = (SEGMENT*)arg;
+	size_t bytes = chunk_bytes(seg->a, seg->opt);
+	char * tmpdata = (char*)malloc(bytes);
+	int streams = analyzer_streams(seg->a);
+	ANALYZER_RESULT r[streams];
+	int hop_bytes = analyzer_hop(seg->a) * format_frame_bytes(&seg->opt->config.format);
+	int hops = bytes / hop_bytes;
+	int chunk, h, s;
+	for (chunk = seg->warm; chunk < seg->last; chunk++) {
+		off_t offset = (off_t)chunk * bytes;
+		size_t pos = 0;
+		while (pos < bytes) {
+			ssize_t len = pread(0, tmpdata + pos, bytes - pos, offset + pos);
+			if (len <= 0) {
+				abort();
+			}
+			pos += len;
+		}
+		for (h = 0; h < hops; h++) {
+			analyze_hop(seg->a, tmpdata + h * hop_bytes, r);
+			if (chunk < seg->first) {
+				continue;
+			}
+			for (s = 0; s < streams; s++) {
+				memcpy(seg->frames + LEN(note_table) * (((long)chunk * hops + h) * streams + s),
+					r[s].notes_present, sizeof(r[s].notes_present));
+			}
+		}
+	}
+	free(tmpdata);
+	return NULL;
+}
+
+void loop_segments(SCALE * scales, int scale_n, OPTIONS * opt) {
+	struct stat st;
+	int chunks, frame_count, i;
+	int n = opt->segments;
+	SEGMENT seg[n];
+	int * frames;
+	int notes_accumulator[LEN(note_table)];
+	int count = 0;
+	int max = opt->max;
+	long samples = 0;
+	double t;
+	OPTIONS engine_opt = *opt;
+	SCALE * scale = NULL;
+	int frames_per_chunk;
+	int streams;
+
+	if (fstat(0, &st) < 0 || !S_ISREG(st.st_mode)) {
+		fprintf(stderr, "SEGMENTS: input must be a regular file\n");
+		exit(1);
+	}
+	/* Any FFTW wisdom is saved once planning is done, so build every
+	 * analyzer up front. The first one says how many chunks there are,
+	 * and no more segments than that are built. */
+	engine_opt.config.threads = 0;
+	planner_begin(&opt->planner);
+	seg[0].a = make_analyzer(opt->config.kernel, &engine_opt);
+	/* A partial chunk at the end is dropped, as input_next does */
+	chunks = st.st_size / chunk_bytes(seg[0].a, opt);
+	if (n > chunks) {
+		n = chunks > 0 ? chunks : 1;
+	}
+	for (i = 0; i < n; i++) {
+		if (i > 0) {
+			seg[i].a = make_analyzer(opt->config.kernel, &engine_opt);
+		}
+		seg[i].opt = opt;
+	}
+	planner_end(&opt->planner);
+
+	frames_per_chunk = chunk_frames(seg[0].a, opt);
+	frame_count = chunks * (frames_per_chunk / analyzer_hop(seg[0].a));
+	streams = analyzer_streams(seg[0].a);
+	frames = (int*)malloc(sizeof(*frames) * LEN(note_table) * streams * (frame_count + 1));
+
+	for (i = 0; i < n; i++) {
+		seg[i].first = (long)chunks * i / n;
+		seg[i].last = (long)chunks * (i+1) / n;
+		seg[i].warm = seg[i].first > opt->warmup ? seg[i].first - opt->warmup : 0;
+		/* The chunk size may not be a multiple of the analyzer's
+		 * period (2^levels for KERNEL_MULTIRATE), so which samples
+		 * each decimator keeps depends on the chunk number. Start on
+		 * a chunk where that matches the sequential run. */
+		seg[i].warm -= seg[i].warm % analyzer_period(seg[i].a);
+		seg[i].frames = frames;
+		samples += (long)(seg[i].last - seg[i].warm) * frames_per_chunk;
+	}
+	fprintf(stderr, "SEGMENTS: %i chunks in %i segments, %i warm-up chunks each\n",
+		chunks, n, opt->warmup);
+
+	t = now();
+	for (i = 0; i < n; i++) {
+		pthread_create(&seg[i].thread, NULL, segment_main, seg + i);
+	}
+	for (i = 0; i < n; i++) {
+		pthread_join(seg[i].thread, NULL);
+		analyzer_destroy(seg[i].a);
+	}
+	t = now() - t;
+
+	/* Stitch the frames back together */
+	memset(notes_accumulator, 0, sizeof(notes_accumulator));
+	for (i = 0; i < frame_count; i++) {
+		int * notes_present = frames + LEN(note_table) * streams * i;
+		int s;
+		for (s = 0; s < streams; s++) {
+			update_accumulator(notes_present + LEN(note_table) * s,
+				notes_accumulator, LEN(note_table));
+		}
 		if ( max > 0 && count > max) {
 			break;
 		}
-
-		/* Periodically (once we've generated enough note counts)
-		 * try to guess the scale.
-		 */
 		if (count > 1000) {
 			scale = guess_scale(scales, scale_n, notes_accumulator);
 			memset(notes_accumulator, 0, sizeof(notes_accumulator));
@@ -386,49 +523,371 @@ void loop2(FILTER * fs, SCALE * scales, int scale_n, int enable_display, int max
 			if (scale) printf("SCALE: %s\n", scale->name);
 		}
 		count++;
-
-		if (enable_display) {
-			/* Update the display */
-			dump_energies(energy, fe, 12, OCTAVES);
-			dump_accumulator(notes_accumulator, LEN(note_table));
-			//printf("%i\n", count);
-			if (scale) printf("SCALE: %s\t", scale->name);
-			dump_notes(notes_present);
+		if (opt->enable_display) {
+			dump_stream_notes(notes_present, streams);
 		}
 	}
 	printf("DONEDONE! %i\n", count);
 	scale = guess_scale(scales, scale_n, notes_accumulator);
 	if (scale) printf("SCALE: %s\n", scale->name);
+	free(frames);
+
+	/* Wall time, counting warm-up samples */
+	report_throughput(kernel_names[opt->config.kernel], samples, t);
 }
 
-void parse_args(int  argc, char ** argv, int * enable_display, int * max) {
+/*
+ * Batch mode: analyze many files at once, one analyzer per job, and print a
+ * single result line per file. This replaces running a fresh process for
+ * every file.
+ */
+typedef struct {
+	char * path;
+	/* 0, or errno if the file couldn't be opened */
+	int error;
+	/* Hops analyzed */
+	int chunks;
+	int notes[LEN(note_table)];
+	SCALE * scale;
+	int score;
+	long samples;
+	double wall;
+} RESULT;
+
+typedef struct {
+	RESULT * results;
+	int n_files;
+	/* Next file to hand out */
+	int next;
+	SCALE * scales;
+	int scale_n;
+	int max;
+	OPTIONS * opt;
+} BATCH;
+
+typedef struct {
+	pthread_t thread;
+	BATCH * batch;
+	ANALYZER * a;
+} JOB;
+
+/* Same analysis as loop2 with no display, reading from |r->path| */
+static void analyze_file(ANALYZER * a, BATCH * b, RESULT * r) {
+	INPUT in;
+	char * tmpdata;
+	int streams = analyzer_streams(a);
+	ANALYZER_RESULT hop[streams];
+	int frames = chunk_frames(a, b->opt);
+	int frame_bytes = format_frame_bytes(&b->opt->config.format);
+	int count = 0;
+	int stop = 0;
+	double t = now();
+	int fd = open(r->path, O_RDONLY);
+	if (fd < 0) {
+		r->error = errno;
+		return;
+	}
+	analyzer_reset(a);
+	memset(r->notes, 0, sizeof(r->notes));
+	input_open(&in, fd, chunk_bytes(a, b->opt));
+	while (!stop && (tmpdata = input_next(&in)) != NULL) {
+		int h, s;
+		for (h = 0; h < frames; h += analyzer_hop(a)) {
+			analyze_hop(a, tmpdata + (size_t)h * frame_bytes, hop);
+			r->chunks++;
+			for (s = 0; s < streams; s++) {
+				update_accumulator(hop[s].notes_present, r->notes, LEN(note_table));
+			}
+			if (b->max > 0 && count > b->max) {
+				stop = 1;
+				break;
+			}
+			if (count > 1000) {
+				memset(r->notes, 0, sizeof(r->notes));
+				count = 0;
+			}
+			count++;
+		}
+	}
+	input_close(&in);
+	close(fd);
+	r->scale = best_scale(b->scales, b->scale_n, r->notes, &r->score);
+	r->samples = (long)r->chunks * analyzer_hop(a);
+	r->wall = now() - t;
+}
+
+static void * job_main(void * arg) {
+	JOB * job = (JOB*)arg;
+	BATCH * b = job->batch;
 	int i;
-	*enable_display = 1;
-	*max = -1;
+	while ((i = __sync_fetch_and_add(&b->next, 1)) < b->n_files) {
+		analyze_file(job->a, b, b->results + i);
+	}
+	return NULL;
+}
+
+static int is_pcm(const struct dirent * d) {
+	size_t len = strlen(d->d_name);
+	return len > 4 && !strcmp(d->d_name + len - 4, ".pcm");
+}
+
+/*
+ * Find the files to analyze: every .pcm file in |path| if it's a
+ * directory, otherwise one file name per line of |path|.
+ */
+static int batch_files(char * path, RESULT ** out) {
+	struct stat st;
+	RESULT * r = NULL;
+	int n = 0;
+	if (strcmp(path, "-") && !stat(path, &st) && S_ISDIR(st.st_mode)) {
+		struct dirent ** names;
+		int i;
+		n = scandir(path, &names, is_pcm, alphasort);
+		if (n < 0) {
+			fprintf(stderr, "BATCH: %s: %s\n", path, strerror(errno));
+			exit(1);
+		}
+		r = (RESULT*)calloc(n, sizeof(*r));
+		for (i = 0; i < n; i++) {
+			asprintf(&r[i].path, "%s/%s", path, names[i]->d_name);
+			free(names[i]);
+		}
+		free(names);
+	} else {
+		FILE * f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+		char * line = NULL;
+		size_t size = 0;
+		ssize_t len;
+		if (!f) {
+			fprintf(stderr, "BATCH: %s: %s\n", path, strerror(errno));
+			exit(1);
+		}
+		while ((len = getline(&line, &size, f)) >= 0) {
+			while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) {
+				line[--len] = 0;
+			}
+			if (len == 0) {
+				continue;
+			}
+			r = (RESULT*)realloc(r, sizeof(*r) * (n + 1));
+			memset(r + n, 0, sizeof(*r));
+			r[n++].path = strdup(line);
+		}
+		free(line);
+	}
+	*out = r;
+	return n;
+}
+
+void loop_batch(SCALE * scales, int scale_n, OPTIONS * opt) {
+	BATCH b;
+	OPTIONS engine_opt = *opt;
+	int jobs = opt->jobs > 0 ? opt->jobs : sysconf(_SC_NPROCESSORS_ONLN);
+	JOB * job;
+	long samples = 0;
+	double t;
+	int i, j;
+
+	memset(&b, 0, sizeof(b));
+	b.n_files = batch_files(opt->batch, &b.results);
+	b.scales = scales;
+	b.scale_n = scale_n;
+	b.max = opt->max;
+	b.opt = opt;
+	if (jobs > b.n_files) {
+		jobs = b.n_files > 0 ? b.n_files : 1;
+	}
+
+	/* Any FFTW wisdom is saved once planning is done, so build every
+	 * analyzer up front */
+	engine_opt.config.threads = 0;
+	job = (JOB*)calloc(jobs, sizeof(*job));
+	planner_begin(&opt->planner);
+	for (i = 0; i < jobs; i++) {
+		job[i].batch = &b;
+		job[i].a = make_analyzer(opt->config.kernel, &engine_opt);
+	}
+	planner_end(&opt->planner);
+
+	t = now();
+	for (i = 0; i < jobs; i++) {
+		pthread_create(&job[i].thread, NULL, job_main, job + i);
+	}
+	for (i = 0; i < jobs; i++) {
+		pthread_join(job[i].thread, NULL);
+	}
+	t = now() - t;
+
+	/* One tab separated line per file, in order */
+	for (i = 0; i < b.n_files; i++) {
+		RESULT * r = b.results + i;
+		if (r->error) {
+			printf("FILE:%s\terror=%s\n", r->path, strerror(r->error));
+			continue;
+		}
+		printf("FILE:%s\tchunks=%i\tscale=%s\tscore=%i\tnotes=",
+			r->path, r->chunks, r->scale ? r->scale->name : "none", r->score);
+		for (j = 0; j < LEN(note_table); j++) {
+			printf("%s%i", j ? "," : "", r->notes[j]);
+		}
+		printf("\twall=%.3f\tsamples_per_sec=%.0f\n", r->wall,
+			r->wall > 0 ? r->samples / r->wall : 0);
+		samples += r->samples;
+	}
+	fprintf(stderr, "BATCH: %i files on %i jobs, %li samples in %.3fs (%.0f samples/sec)\n",
+		b.n_files, jobs, samples, t, t > 0 ? samples / t : 0);
+}
+
+int parse_kernel(char * name) {
+	int kernel = analyzer_kernel(name);
+	if (kernel < 0) {
+		fprintf(stderr, "UNKNOWN KERNEL: %s\n", name);
+		exit(1);
+	}
+	return kernel;
+}
+
+void parse_args(int  argc, char ** argv, OPTIONS * opt) {
+	int i;
+	opt->enable_display = 1;
+	opt->max = -1;
+	analyzer_config_default(&opt->config);
+	opt->config.log = stderr;
+	opt->compare = -1;
+	memset(&opt->planner, 0, sizeof(opt->planner));
+	opt->segments = 0;
+	opt->warmup = 50;
+	opt->batch = NULL;
+	opt->jobs = 0;
+	opt->ring = 0;
+	opt->read_ms = 0;
+	opt->validate = 0;
 	for (i = 1; i < argc; i++) {
 		if (!strcmp(argv[i], "-nodisplay")) {
-			*enable_display = 0;
+			opt->enable_display = 0;
+		} else if (!strcmp(argv[i], "-frames")) {
+			opt->enable_display = 2;
 		} else if (!strcmp(argv[i], "-max")) {
-			*max = atoi(argv[++i]);
+			opt->max = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-kernel") || !strcmp(argv[i], "-engine")) {
+			/* Filter kernels and other detectors share one namespace
+			 * so any of them can be compared with any other */
+			opt->config.kernel = parse_kernel(argv[++i]);
+		} else if (!strcmp(argv[i], "-isa")) {
+			opt->config.isa = argv[++i];
+		} else if (!strcmp(argv[i], "-compare")) {
+			opt->compare = parse_kernel(argv[++i]);
+		} else if (!strcmp(argv[i], "-threads")) {
+			opt->config.threads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-partition")) {
+			/* "octave" or "range" */
+			opt->config.by_octave = !strcmp(argv[++i], "octave");
+		} else if (!strcmp(argv[i], "-segments")) {
+			opt->segments = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-batch")) {
+			opt->batch = argv[++i];
+		} else if (!strcmp(argv[i], "-jobs")) {
+			opt->jobs = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-rate")) {
+			opt->config.format.sample_rate = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-channels")) {
+			opt->config.format.channels = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-format")) {
+			/* s16le or f32le */
+			if (format_parse(&opt->config.format, argv[++i]) < 0) {
+				fprintf(stderr, "UNKNOWN FORMAT: %s\n", argv[i]);
+				exit(1);
+			}
+		} else if (!strcmp(argv[i], "-mix")) {
+			/* left, mid, side or each */
+			if (mix_parse(&opt->config.mix, argv[++i]) < 0) {
+				fprintf(stderr, "UNKNOWN MIX: %s\n", argv[i]);
+				exit(1);
+			}
+		} else if (!strcmp(argv[i], "-bins")) {
+			/* Filters per octave, a multiple of 12 */
+			opt->config.bins = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-octaves")) {
+			opt->config.octaves = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-base")) {
+			/* Frequency of the lowest C in Hz */
+			opt->config.base = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-hop")) {
+			/* Milliseconds between note guesses */
+			opt->config.hop_ms = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-read")) {
+			/* Milliseconds of input to read at once */
+			opt->read_ms = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-gate")) {
+			/* RMS level, 0 for digital silence only */
+			opt->config.gate = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-validate")) {
+			opt->validate = 1;
+		} else if (!strcmp(argv[i], "-ring")) {
+			opt->ring = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-warmup")) {
+			/* In chunks */
+			opt->warmup = atoi(argv[++i]);
+		} else if (planner_arg(&opt->planner, argc, argv, &i)) {
+			continue;
 		} else {
 			fprintf(stderr, "BAD ARGS\n");
 			exit(1);
 		}
 	}
+	/* Validate against the double precision bank unless told otherwise */
+	if (opt->validate && opt->compare < 0) {
+		opt->compare = KERNEL_BLOCK;
+	}
+	/* Read one hop at a time unless told otherwise */
+	if (opt->read_ms == 0) {
+		opt->read_ms = opt->config.hop_ms;
+	}
+	if (opt->config.hop_ms < 1 || opt->config.hop_ms > 1000 ||
+			opt->read_ms < opt->config.hop_ms || opt->read_ms % opt->config.hop_ms) {
+		fprintf(stderr, "BAD HOP: -read must be a multiple of -hop\n");
+		exit(1);
+	}
+	/* The top octave goes up to ~2kHz */
+	if (opt->config.format.sample_rate < 8000 || opt->config.format.channels < 1) {
+		fprintf(stderr, "BAD FORMAT: %iHz, %i channels\n",
+			opt->config.format.sample_rate, opt->config.format.channels);
+		exit(1);
+	}
 }
 
 
 int main(int argc, char ** argv) {
 
-	FILTER * fs;
+	ANALYZER * fs;
+	ANALYZER * ref = NULL;
 	SCALE * scale;
 	int scale_n;
-	int enable_display;
-	int max;
-	parse_args(argc, argv, &enable_display, &max);
-	build_all_scales(&scale, &scale_n);
-	fs = make_filters(note_table, note_names, LEN(note_table), OCTAVES, SAMPLE_RATE);
-	loop2(fs, scale, scale_n, enable_display, max);
+	OPTIONS opt;
+	/* Program-wide read-only state, shared by every analyzer */
+	ARENA * arena = arena_create(1 << 20);
+	parse_args(argc, argv, &opt);
+	build_all_scales(arena, &scale, &scale_n);
+	arena_seal(arena);
+	if (opt.batch) {
+		loop_batch(scale, scale_n, &opt);
+		return 0;
+	}
+	if (opt.segments > 0) {
+		loop_segments(scale, scale_n, &opt);
+		return 0;
+	}
+	planner_begin(&opt.planner);
+	fs = make_analyzer(opt.config.kernel, &opt);
+	if (opt.compare >= 0) {
+		ref = make_analyzer(opt.compare, &opt);
+	}
+	planner_end(&opt.planner);
+	loop2(fs, ref, scale, scale_n, &opt);
+	analyzer_destroy(fs);
+	if (ref) {
+		analyzer_destroy(ref);
+	}
 
 
 	return 0;
@@ -0,0 +1,149 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "arena.h"
+#include "multirate.h"
+
+/* How many nonzero taps on each side of the center */
+#define SIDE_TAPS ((HALFBAND_TAPS + 1) / 4)
+
+/*
+ * Half-band low-pass taps (cutoff at a quarter of the input rate). Every
+ * other tap except the center one is zero and the filter is symmetric,
+ * so only the odd taps on one side are stored: side_taps[k] is the tap
+ * 2k+1 samples away from the center.
+ */
+static double center_tap;
+static double side_taps[SIDE_TAPS];
+/* The taps are designed once, whichever thread gets there first */
+static pthread_once_t halfband_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Windowed sinc design. With a Blackman window on 31 taps, anything more
+ * than an eighth of the input rate above the cutoff is attenuated by
+ * ~75dB, which is what multirate_pick_level relies on.
+ */
+static void halfband_design(void) {
+	int m = HALFBAND_TAPS / 2;
+	int k;
+	double sum;
+	center_tap = 0.5;
+	sum = center_tap;
+	for (k = 0; k < SIDE_TAPS; k++) {
+		int n = 2 * k + 1;
+		double w = 0.42 + 0.5 * cos(M_PI * n / (m + 1))
+			+ 0.08 * cos(2 * M_PI * n / (m + 1));
+		side_taps[k] = sin(M_PI * n / 2) / (M_PI * n) * w;
+		sum += 2 * side_taps[k];
+	}
+	/* Unity gain at DC */
+	center_tap /= sum;
+	for (k = 0; k < SIDE_TAPS; k++) {
+		side_taps[k] /= sum;
+	}
+}
+
+/*
+ * Push |n| samples through one stage. Writes the decimated output to
+ * |out| and returns how many samples were produced (n/2, give or take
+ * one; which samples are kept carries over from one call to the next).
+ */
+static int halfband_decimate(HALFBAND * h, const double * x, int n, double * out) {
+	int t, k;
+	int produced = 0;
+	int history = HALFBAND_TAPS - 1;
+	int center = HALFBAND_TAPS / 2;
+	double * w = h->work;
+
+	/* The work buffer is the last HALFBAND_TAPS-1 inputs followed by
+	 * the new block, so every output's window is contiguous */
+	memcpy(w + history, x, sizeof(*x) * n);
+	for (t = h->phase; t < n; t += 2) {
+		/* Window ending with input sample t */
+		const double * win = w + t;
+		double y = center_tap * win[center];
+		for (k = 0; k < SIDE_TAPS; k++) {
+			y += side_taps[k] * (win[center - 2*k - 1] + win[center + 2*k + 1]);
+		}
+		out[produced++] = y;
+	}
+	h->phase = t - n;
+	memmove(w, w + n, sizeof(*w) * history);
+	return produced;
+}
+
+/*
+ * Set up a cascade producing |levels| decimated signals from blocks of at
+ * most |max_block| input samples.
+ */
+MULTIRATE * multirate_create(ARENA * arena, int levels, int max_block) {
+	MULTIRATE * m;
+	int i;
+	if (levels > MAX_LEVELS) {
+		abort();
+	}
+	pthread_once(&halfband_once, halfband_design);
+	m = (MULTIRATE*)arena_alloc(arena, sizeof(*m));
+	m->levels = levels;
+	for (i = 1; i <= levels; i++) {
+		HALFBAND * h = m->stages + i - 1;
+		h->work = (double*)arena_alloc(arena, sizeof(double) * (HALFBAND_TAPS - 1 + max_block));
+		/* The first output is on the second input sample */
+		h->phase = 1;
+		/* Each level gets at most half (rounded up) of the one above */
+		max_block = (max_block + 1) / 2;
+		m->buffer[i] = (double*)arena_alloc(arena, sizeof(double) * max_block);
+	}
+	return m;
+}
+
+/*
+ * Run a block of input through the cascade. Afterwards m->level[k] holds
+ * m->count[k] new samples at 1/2^k of the input rate.
+ */
+void multirate_process(MULTIRATE * m, const double * x, int n) {
+	int i;
+	m->level[0] = x;
+	m->count[0] = n;
+	for (i = 1; i <= m->levels; i++) {
+		m->count[i] = halfband_decimate(m->stages + i - 1,
+			m->level[i-1], m->count[i-1], m->buffer[i]);
+		m->level[i] = m->buffer[i];
+	}
+}
+
+/* Forget all input, as if the cascade had just been created */
+void multirate_reset(MULTIRATE * m) {
+	int i;
+	for (i = 0; i < m->levels; i++) {
+		memset(m->stages[i].work, 0, sizeof(double) * (HALFBAND_TAPS - 1));
+		m->stages[i].phase = 1;
+	}
+}
+
+/*
+ * What is the deepest level at which a note of |top_freq| is still safe?
+ * We want it below a quarter of the decimated rate: that keeps it in the
+ * flat part of the half-band passband and keeps everything that can alias
+ * onto it in the stopband.
+ */
+int multirate_pick_level(double top_freq, double sample_freq) {
+	int level = 0;
+	while (level < MAX_LEVELS && sample_freq / (2 << level) >= 4 * top_freq) {
+		level++;
+	}
+	return level;
+}
@@ -0,0 +1,47 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+/*
+ * A cascade of half-band decimators. Level 0 is the input signal, level k
+ * is the input low-pass filtered and decimated by 2^k. Low notes don't
+ * need 44.1kHz so each octave of filters can run on the lowest level
+ * that still comfortably contains it. Include arena.h first.
+ */
+
+/* Length of each half-band FIR. Must be 4k+3 so the outer taps are nonzero */
+#define HALFBAND_TAPS 31
+
+/* Deepest level we can decimate to */
+#define MAX_LEVELS 8
+
+typedef struct {
+	/* The last HALFBAND_TAPS-1 input samples, followed by room for a
+	 * block of new ones */
+	double * work;
+	/* Index in the next block of the first sample that produces an
+	 * output (0 or 1) */
+	int phase;
+} HALFBAND;
+
+typedef struct {
+	int levels;
+	HALFBAND stages[MAX_LEVELS];
+	/* Output of each level for the last block (level 0 is the input) */
+	const double * level[MAX_LEVELS + 1];
+	int count[MAX_LEVELS + 1];
+	double * buffer[MAX_LEVELS + 1];
+} MULTIRATE;
+
+MULTIRATE * multirate_create(ARENA * arena, int levels, int max_block);
+void multirate_process(MULTIRATE * m, const double * x, int n);
+void multirate_reset(MULTIRATE * m);
+int multirate_pick_level(double top_freq, double sample_freq);
@@ -0,0 +1,83 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+#include <complex.h>
+#include <fftw3.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "planner.h"
+
+static double planner_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * If argv[*i] is a planner option, consume it (and its argument) and
+ * return 1. Otherwise return 0.
+ */
+int planner_arg(PLANNER * p, int argc, char ** argv, int * i) {
+	if (!strcmp(argv[*i], "-wisdom") && *i + 1 < argc) {
+		p->path = argv[++*i];
+	} else if (!strcmp(argv[*i], "-fast")) {
+		p->fast = 1;
+	} else if (!strcmp(argv[*i], "-plan")) {
+		p->plan_only = 1;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+void planner_begin(PLANNER * p) {
+	int loaded = 0;
+	p->start = planner_now();
+	if (p->plan_only && !p->path) {
+		fprintf(stderr, "-plan needs -wisdom FILE\n");
+		exit(1);
+	}
+	if (p->path && !p->plan_only) {
+		loaded = fftw_import_wisdom_from_filename(p->path);
+		fprintf(stderr, "FFTW: %s wisdom from %s\n",
+			loaded ? "loaded" : "no", p->path);
+	}
+
+	if (p->plan_only) {
+		/* Wisdom from a more thorough planner also satisfies
+		 * FFTW_MEASURE, so we can afford to take our time */
+		p->flags = FFTW_PATIENT;
+	} else if (p->fast && !loaded) {
+		p->flags = FFTW_ESTIMATE;
+	} else {
+		p->flags = FFTW_MEASURE;
+	}
+}
+
+/*
+ * Report how long planning took. In -plan mode, save the wisdom and exit.
+ */
+void planner_end(PLANNER * p) {
+	fprintf(stderr, "FFTW: planning took %.3fs (%s)\n", planner_now() - p->start,
+		p->flags == FFTW_ESTIMATE ? "estimate" :
+		p->flags == FFTW_PATIENT ? "patient" : "measure");
+	if (p->plan_only) {
+		if (!fftw_export_wisdom_to_filename(p->path)) {
+			fprintf(stderr, "FFTW: could not write wisdom to %s\n", p->path);
+			exit(1);
+		}
+		fprintf(stderr, "FFTW: saved wisdom to %s\n", p->path);
+		exit(0);
+	}
+}
@@ -0,0 +1,35 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+/*
+ * Shared FFTW planner setup. FFTW_MEASURE planning is slow, so we can
+ * remember its results in a wisdom file:
+ *
+ *   -wisdom FILE   load wisdom from FILE at startup
+ *   -plan          plan (harder than usual), save wisdom to FILE and exit
+ *   -fast          if there's no wisdom, plan with FFTW_ESTIMATE instead
+ *
+ * Call planner_begin before creating any plans and planner_end after.
+ */
+typedef struct {
+	char * path;
+	int fast;
+	int plan_only;
+
+	/* Planner flags to pass to fftw_plan_* (set by planner_begin) */
+	unsigned flags;
+	double start;
+} PLANNER;
+
+int planner_arg(PLANNER * p, int argc, char ** argv, int * i);
+void planner_begin(PLANNER * p);
+void planner_end(PLANNER * p);
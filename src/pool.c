@@ -0,0 +1,158 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sched.h>
+#include <unistd.h>
+#include "arena.h"
+#include "bank.h"
+#include "pool.h"
+
+/* Build this worker's part of the bank on the worker's own CPU */
+static void worker_setup(WORKER * w) {
+	POOL * p = w->pool;
+	int i;
+	cpu_set_t cpus;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (ncpu > 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(w->index % ncpu, &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+
+	/* The arena isn't thread safe, but the memory is still first
+	 * touched on this CPU */
+	pthread_mutex_lock(&p->lock);
+	w->bank = bank_create(p->arena, w->count);
+	pthread_mutex_unlock(&p->lock);
+	for (i = 0; i < w->count; i++) {
+		int j = w->first + i;
+		bank_set_filter(w->bank, i, p->proto->dsin[j], p->proto->dcos[j],
+			p->proto->rolloff[j], p->proto->normalizer[j]);
+	}
+	bank_select_isa(w->bank, p->isa);
+}
+
+static void * worker_main(void * arg) {
+	WORKER * w = (WORKER*)arg;
+	POOL * p = w->pool;
+	unsigned long seen = 0;
+
+	worker_setup(w);
+	pthread_barrier_wait(&p->done);
+
+	while (1) {
+		pthread_mutex_lock(&p->lock);
+		while (p->generation == seen && !p->quit) {
+			pthread_cond_wait(&p->go, &p->lock);
+		}
+		seen = p->generation;
+		pthread_mutex_unlock(&p->lock);
+		if (p->quit) {
+			break;
+		}
+
+		bank_process_block(w->bank, p->x, p->samples);
+		pthread_barrier_wait(&p->done);
+	}
+	return NULL;
+}
+
+/*
+ * Start |n_workers| threads. Worker i owns filters first[i] ..
+ * first[i]+count[i]-1 of |proto|. Returns once every worker's bank is
+ * ready.
+ */
+POOL * pool_create(ARENA * arena, BANK * proto, char * isa, int n_workers,
+	const int * first, const int * count) {
+	POOL * p;
+	int i;
+	p = (POOL*)arena_alloc(arena, sizeof(*p));
+	p->n_workers = n_workers;
+	p->proto = proto;
+	p->isa = isa;
+	p->arena = arena;
+	p->workers = (WORKER*)arena_alloc(arena, n_workers * sizeof(WORKER));
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->go, NULL);
+	/* The workers plus the thread calling pool_process_block */
+	pthread_barrier_init(&p->done, NULL, n_workers + 1);
+
+	for (i = 0; i < n_workers; i++) {
+		WORKER * w = p->workers + i;
+		w->pool = p;
+		w->index = i;
+		w->first = first[i];
+		w->count = count[i];
+		if (pthread_create(&w->thread, NULL, worker_main, w)) {
+			abort();
+		}
+	}
+	pthread_barrier_wait(&p->done);
+	return p;
+}
+
+/* Run every worker's filters over a block and wait for them all */
+void pool_process_block(POOL * p, const double * x, int samples) {
+	pthread_mutex_lock(&p->lock);
+	p->x = x;
+	p->samples = samples;
+	p->generation++;
+	pthread_cond_broadcast(&p->go);
+	pthread_mutex_unlock(&p->lock);
+
+	pthread_barrier_wait(&p->done);
+}
+
+/* Collect the energies from every worker into one array */
+void pool_energy_max(POOL * p, double * energy) {
+	int i;
+	for (i = 0; i < p->n_workers; i++) {
+		WORKER * w = p->workers + i;
+		bank_energy_max(w->bank, energy + w->first);
+	}
+}
+
+/* Reset every worker's filters. Only call this between blocks. */
+void pool_reset(POOL * p) {
+	int i;
+	for (i = 0; i < p->n_workers; i++) {
+		bank_reset(p->workers[i].bank);
+	}
+}
+
+/* bank_decay for every worker. Cheap enough to do on the calling thread. */
+void pool_decay(POOL * p, int samples) {
+	int i;
+	for (i = 0; i < p->n_workers; i++) {
+		bank_decay(p->workers[i].bank, samples);
+	}
+}
+
+/* Stop the workers. Their banks go with the arena. */
+void pool_destroy(POOL * p) {
+	int i;
+	pthread_mutex_lock(&p->lock);
+	p->quit = 1;
+	pthread_cond_broadcast(&p->go);
+	pthread_mutex_unlock(&p->lock);
+	for (i = 0; i < p->n_workers; i++) {
+		pthread_join(p->workers[i].thread, NULL);
+	}
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->go);
+	pthread_barrier_destroy(&p->done);
+}
@@ -0,0 +1,61 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+#include <pthread.h>
+
+/*
+ * A filter bank split across worker threads. Each worker owns a
+ * contiguous range of filters in its own BANK, allocated and initialized
+ * by the worker itself (and pinned to one CPU) so its state stays local
+ * to the core that updates it.
+ *
+ * Per block the caller publishes the input and bumps a generation count
+ * to wake the workers; the only synchronization after that is a single
+ * barrier once every worker is done.
+ *
+ * Include bank.h first. The workers' banks come out of the same ARENA.
+ */
+typedef struct WORKER {
+	pthread_t thread;
+	struct POOL * pool;
+	int index;
+	/* Which filters of the full bank we own */
+	int first;
+	int count;
+	BANK * bank;
+} WORKER;
+
+typedef struct POOL {
+	int n_workers;
+	WORKER * workers;
+	/* Parameters for every filter; workers copy their range from it */
+	BANK * proto;
+	char * isa;
+	ARENA * arena;
+
+	pthread_mutex_t lock;
+	pthread_cond_t go;
+	unsigned long generation;
+	int quit;
+	pthread_barrier_t done;
+
+	/* Current block */
+	const double * x;
+	int samples;
+} POOL;
+
+POOL * pool_create(ARENA * arena, BANK * proto, char * isa, int n_workers, const int * first, const int * count);
+void pool_process_block(POOL * p, const double * x, int samples);
+void pool_energy_max(POOL * p, double * energy);
+void pool_reset(POOL * p);
+void pool_decay(POOL * p, int samples);
+void pool_destroy(POOL * p);
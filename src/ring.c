@@ -0,0 +1,100 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "shared.h"
+#include "ring.h"
+
+static void * ring_slot(RING * r, unsigned long i) {
+	return r->buffer + (size_t)r->chunk_bytes * i;
+}
+
+static void * capture_main(void * arg) {
+	RING * r = (RING*)arg;
+	unsigned long head = 0;
+	while (1) {
+		unsigned long tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		void * slot;
+		if (head - tail >= r->slots) {
+			/* Full. Keep the pipe moving and lose this chunk. */
+			slot = ring_slot(r, r->slots);
+			if (read_data(r->fd, slot, r->chunk_bytes) < 0) {
+				break;
+			}
+			r->dropped++;
+			continue;
+		}
+		slot = ring_slot(r, head % r->slots);
+		if (read_data(r->fd, slot, r->chunk_bytes) < 0) {
+			break;
+		}
+		head++;
+		__atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+		if (head - tail > r->high_water) {
+			r->high_water = head - tail;
+		}
+		sem_post(&r->ready);
+	}
+	sem_post(&r->ready);
+	return NULL;
+}
+
+/* Start capturing from |fd| into a ring of |slots| chunks */
+RING * ring_create(int fd, int chunk_bytes, int slots) {
+	RING * r;
+	r = (RING*)malloc(sizeof(*r));
+	memset(r, 0, sizeof(*r));
+	r->fd = fd;
+	r->chunk_bytes = chunk_bytes;
+	r->slots = slots;
+	r->buffer = (char*)malloc((size_t)chunk_bytes * (slots + 1));
+	sem_init(&r->ready, 0, 0);
+	if (pthread_create(&r->thread, NULL, capture_main, r)) {
+		abort();
+	}
+	return r;
+}
+
+/*
+ * Wait for the next chunk and return it, or NULL once the input has ended
+ * and every chunk has been taken. The chunk is ours until the next call.
+ */
+void * ring_next(RING * r) {
+	unsigned long tail = r->tail;
+	unsigned long head;
+	if (r->holding) {
+		/* Hand the previous chunk back to the capture thread */
+		tail++;
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+		r->holding = 0;
+	}
+	while (sem_wait(&r->ready) < 0) {
+	}
+	head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	if (head == tail) {
+		/* Only the end of input wakes us without a chunk */
+		pthread_join(r->thread, NULL);
+		return NULL;
+	}
+	if (head - tail > 1) {
+		r->late++;
+	}
+	r->holding = 1;
+	return ring_slot(r, tail % r->slots);
+}
+
+void ring_report(RING * r) {
+	fprintf(stderr, "RING: high water %lu of %i chunks, %lu dropped, %lu late\n",
+		r->high_water, r->slots, r->dropped, r->late);
+}
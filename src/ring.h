@@ -0,0 +1,53 @@
+/* Copyright (C) 2016 David Stafford
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License, version 2 as published by the Free
+Software Foundation.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+*/
+
+
+#include <pthread.h>
+#include <semaphore.h>
+
+/*
+ * Live capture on its own thread. The capture thread keeps reading chunks
+ * from a file descriptor into a ring of chunk buffers; the analysis thread
+ * takes them out in order. There is exactly one writer and one reader so
+ * the ring itself needs no locks, only ordered loads and stores of |head|
+ * and |tail|. The semaphore is just so an idle reader can sleep.
+ *
+ * Capture never waits for analysis: if the ring is full the chunk is read
+ * anyway (so arecord never overruns) and thrown away.
+ */
+typedef struct {
+	int fd;
+	int chunk_bytes;
+	int slots;
+	/* slots chunk buffers, then one to read dropped chunks into */
+	char * buffer;
+
+	/* Chunks written and chunks released by the reader. Only the capture
+	 * thread stores |head| and only the reader stores |tail|. */
+	unsigned long head;
+	unsigned long tail;
+	/* The reader holds on to the chunk it was last given */
+	int holding;
+	/* Posted once per chunk written and once more at the end */
+	sem_t ready;
+	pthread_t thread;
+
+	/* Most chunks ever waiting, chunks dropped because the ring was full
+	 * and chunks that had others queued behind them when they were
+	 * taken (analysis was running behind) */
+	unsigned long high_water;
+	unsigned long dropped;
+	unsigned long late;
+} RING;
+
+RING * ring_create(int fd, int chunk_bytes, int slots);
+void * ring_next(RING * r);
+void ring_report(RING * r);
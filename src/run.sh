@@ -1,2 +1,2 @@
 #!/bin/bash
-arecord -f cd --device=hw:2,1 |  ./awesome $*
+arecord -f cd --device=hw:2,1 |  ./awesome -ring 16 $*
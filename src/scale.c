@@ -13,6 +13,7 @@ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
 #define _GNU_SOURCE
 #include <complex.h>
 #include "shared.h"
+#include "arena.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,13 +26,12 @@ int harmonic_minor_progression[]=  {2,1,2,2,1,2,2, -1};
 
 
 /*
- * Build  "scale", a set of allowed notes from a given progression.
+ * Build  "scale", a set of allowed notes from a given progression, in
+ * the 12 SCALEs at |s|.
  * basename is just used to render the name of the scale.
  */
-SCALE * build_scales(int * progression, char * basename) {
+void build_scales(SCALE * s, int * progression, char * basename) {
 	int i;
-	SCALE * s;
-	s = (SCALE*)malloc(sizeof(SCALE) *12 );
 
 	/* Loop over all starting notes */
 	for (i = 0; i < 12; i++) {
@@ -41,7 +41,7 @@ SCALE * build_scales(int * progression, char * basename) {
 		current = s+i;
 		memset(current, 0, sizeof(SCALE));
 		
-		asprintf(&current->name, "%s %s", basename, note_names[i]);
+		snprintf(current->name, sizeof(current->name), "%s %s", basename, note_names[i]);
 
 		index = i;
 		/* Loop over the progression */
@@ -50,30 +50,20 @@ SCALE * build_scales(int * progression, char * basename) {
 			index = (index + progression[j]) % 12;
 		}
 	}
-	return s;
 }
 
-void * append(void * a, int ai, void *b, int bi) {
-	void * res;
-	res = malloc(ai + bi);
-	memcpy(res, a, ai);
-	memcpy(res + ai, b, bi);
-	return res;
-}
-
-void  build_all_scales(SCALE ** out, int * n) {
-	SCALE  *major, *all;
-	// SCALE * minor
+/* The scales live in |arena|, room is left for the minor ones */
+void  build_all_scales(ARENA * arena, SCALE ** out, int * n) {
+	SCALE  *all;
 	int i;
 
 	fprintf(stderr, "START BUILD SCALE\n");
-	//minor = build_scales(harmonic_minor_progression, "minor");
-	major = build_scales(major_scale_progression, "major");
+	all = (SCALE*)arena_alloc(arena, sizeof(SCALE) * 24);
+	build_scales(all, major_scale_progression, "major");
+	//build_scales(all + 12, harmonic_minor_progression, "minor");
 
-	//all = append(minor, 12*sizeof(SCALE), major, 12 * sizeof(SCALE));
 	*n = 12;
-	*out = major;
-	all = major;
+	*out = all;
 
 	for (i = 0; i < 12; i++) {
 		int j;
@@ -108,9 +98,9 @@ int test_scale(int * note_frequencies, SCALE * s) {
 }
 
 /*
- * Try all scales in s and return the best fit.
+ * Try all scales in s and return the best fit. Its score goes in |score|.
  */
-SCALE * guess_scale(SCALE * s, int num_scales, int * note_frequencies) {
+SCALE * best_scale(SCALE * s, int num_scales, int * note_frequencies, int * score) {
 	int i;
 	SCALE * best = NULL;
 	int best_score = -10000000;
@@ -124,6 +114,17 @@ SCALE * guess_scale(SCALE * s, int num_scales, int * note_frequencies) {
 		}
 	}
 
+	*score = best_score;
+	return best;
+}
+
+/*
+ * Same as best_scale, but also report the winner on stderr.
+ */
+SCALE * guess_scale(SCALE * s, int num_scales, int * note_frequencies) {
+	int best_score;
+	SCALE * best = best_scale(s, num_scales, note_frequencies, &best_score);
+
 	if (best!= NULL) {
 		fprintf(stderr, "SCALE: %s (%i)\n", best->name, best_score);
 	}
@@ -0,0 +1,13 @@
+#!/bin/bash
+# Measure how the threaded block kernel scales with the number of threads.
+# usage: scaling.sh FILE [PARTITION]
+# PARTITION is "range" (the default) or "octave".
+
+part=${2:-range}
+
+for n in 1 2 4 8 16; do
+	./awesome -nodisplay -kernel block -threads $n -partition $part < "$1" 2>&1 >/dev/null | grep '^KERNEL' | sed "s/^/THREADS $n /"
+done | awk '
+	{ n=$2; rate=$9; sub("\\(", "", rate) }
+	n == 1 { base=rate }
+	{ printf("%2i threads: %.0f samples/sec, %.2fx, efficiency %.0f%%\n", n, rate, rate/base, 100*rate/(base*n)) }'
@@ -11,6 +11,9 @@ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shared.h"
 
 
 /*
@@ -20,19 +23,17 @@ double note_table[] = {65.41, 69.30, 73.42, 77.78, 82.41, 87.31, 92.50, 98.00, 1
 char *note_names[] = {"C ", "C#", "D ", "D#", "E ", "F ", "F#", "G ", "G#", "A ", "A#", "B "};
 
 /*
- * Read raw data into memory. Put it in output
+ * Read |bytes| of raw data from |fd| into output. Returns -1 if the input
+ * ends first.
  */
-int get_data_chunk(short * output, int chunk_samples) {
-	/*
-	 * Bytes = chunk_size * bytes_per_short * channels 
-	 */
-	int left_to_read = chunk_samples* 2 * 2;
+int read_data(int fd, void * output, int bytes) {
+	int left_to_read = bytes;
 	int pos = 0;
 
 	/* Keep reading until we have enough data */
 	while (left_to_read > 0) {
 		int len;
-		len = read(0, ((char*)(output))  + pos, left_to_read);
+		len = read(fd, ((char*)(output))  + pos, left_to_read);
 		if (len <0) {
 			abort();
 		}
@@ -46,4 +47,55 @@ int get_data_chunk(short * output, int chunk_samples) {
 	return 0;
 }
 
+void input_open(INPUT * in, int fd, int chunk_bytes) {
+	struct stat st;
+	in->fd = fd;
+	in->chunk_bytes = chunk_bytes;
+	in->map = NULL;
+	in->size = 0;
+	in->pos = 0;
+	in->buffer = NULL;
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			in->map = (char*)map;
+			in->size = st.st_size;
+			/* Carry on from wherever the file offset was */
+			in->pos = lseek(fd, 0, SEEK_CUR);
+			return;
+		}
+	}
+	in->buffer = malloc(chunk_bytes);
+}
+
+/*
+ * Get the next chunk of raw samples, or NULL at the end of the input.
+ * The chunk is only good until the next call.
+ */
+void * input_next(INPUT * in) {
+	size_t bytes = in->chunk_bytes;
+	void * chunk;
+	if (!in->map) {
+		if (read_data(in->fd, in->buffer, in->chunk_bytes) < 0) {
+			return NULL;
+		}
+		return in->buffer;
+	}
+	/* Like the read path, a partial chunk at the end is dropped */
+	if (in->pos >= in->size || in->size - in->pos < bytes) {
+		return NULL;
+	}
+	chunk = in->map + in->pos;
+	in->pos += bytes;
+	return chunk;
+}
 
+void input_close(INPUT * in) {
+	if (in->map) {
+		munmap(in->map, in->size);
+	}
+	free(in->buffer);
+	in->map = NULL;
+	in->buffer = NULL;
+}
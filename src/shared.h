@@ -10,16 +10,38 @@ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
 */
 
 
+#include <stddef.h>
 
 typedef struct {
 	int legal_notes[12];
-	char * name;
+	char name[16];
 } SCALE;
 
 
 SCALE  * guess_scale(SCALE *s, int num_scales, int * note_frequencies);
-void build_all_scales(SCALE ** out, int * n);
-int get_data_chunk(short * output, int chunk_samples);
+SCALE * best_scale(SCALE * s, int num_scales, int * note_frequencies, int * score);
+/* See arena.h */
+struct ARENA;
+void build_all_scales(struct ARENA * arena, SCALE ** out, int * n);
+int read_data(int fd, void * output, int bytes);
+
+/*
+ * Where input chunks come from. A regular file is mapped into memory and
+ * chunks point straight into the mapping; anything else (a pipe from
+ * arecord, say) is read() into |buffer| one chunk at a time.
+ */
+typedef struct {
+	int fd;
+	int chunk_bytes;
+	char * map;
+	size_t size;
+	size_t pos;
+	void * buffer;
+} INPUT;
+
+void input_open(INPUT * in, int fd, int chunk_bytes);
+void * input_next(INPUT * in);
+void input_close(INPUT * in);
 
 extern double note_table[12];
 extern char *note_names[12];
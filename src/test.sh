@@ -1,12 +1,6 @@
 #!/bin/bash
+# Analyze every .pcm file in DIR and write one result line per file to
+# OUTPUT.
+# usage: test.sh DIR OUTPUT [JOBS]
 
-echo "" > $2
-
-for i in $1/*.pcm; do
-	echo RUNNING TEST $i
-	echo ================================================ >> $2
-	echo FILE:$i >> $2
-	./awesome -nodisplay -max 500 < "$i" >>$2; 
-	echo >> $2
-	echo >> $2
-done
+./awesome -batch "$1" -max 500 ${3:+-jobs $3} > "$2"